@@ -19,35 +19,55 @@
 #include "Alarm.h"
 
 #include "CommandQueue.h"
+#include "DeadlineScheduler.h"
 
 #include <QDebug>
-#include <QTimer>
 
 class AlarmList::Private
 {
 public:
     Private(AlarmList* qq)
         : q(qq)
-        , alarmTimer(new QTimer(qq))
     {
-        // We run to the minute, so wake up every half minute to check if we have an alarm coming up
-        // NB: The timer only runs when there is more than zero alarms in the list.
-        alarmTimer->setInterval(0.5 * 60000);
-        QObject::connect(alarmTimer, &QTimer::timeout, qq, [this](){ checkAlarms(); });
     }
     AlarmList* q;
     CommandQueue* commandQueue = nullptr;
 
     QList<Alarm*> list;
 
-    QTimer* alarmTimer = nullptr;
+    // We run to the minute, so wake up every half minute to check if we have an alarm coming up
+    // NB: The checks only run when there is more than zero alarms in the list.
+    static constexpr qint64 checkInterval{30000};
+    DeadlineScheduler::Handle checkHandle{0};
+    QDeadlineTimer nextCheck;
+    void startChecking() {
+        if (!DeadlineScheduler::getInstance()->isScheduled(checkHandle)) {
+            nextCheck = DeadlineScheduler::deadlineIn(checkInterval);
+            scheduleCheck();
+        }
+    }
+    void stopChecking() {
+        DeadlineScheduler::getInstance()->cancel(checkHandle);
+        checkHandle = 0;
+    }
+    void scheduleCheck() {
+        checkHandle = DeadlineScheduler::getInstance()->scheduleAt(nextCheck, q, [this](){
+            // Step on from when we meant to check, so we stay on the half minute
+            nextCheck += checkInterval;
+            if (nextCheck.hasExpired()) {
+                nextCheck = DeadlineScheduler::deadlineIn(checkInterval);
+            }
+            scheduleCheck();
+            checkAlarms();
+        });
+    }
     void checkAlarms() {
         if(!commandQueue) {
             qDebug() << "You forgot to set the command queue on the alarm list, silly person!";
             return;
         }
         quint64 now = QDateTime::currentDateTime().toMSecsSinceEpoch();
-        quint64 interval(alarmTimer->interval());
+        quint64 interval(checkInterval);
         for( Alarm* alarm : list)
         {
             quint64 then = alarm->time().toMSecsSinceEpoch();
@@ -180,8 +200,8 @@ void AlarmList::addAlarm(Alarm* alarm)
     Q_EMIT listChanged();
     endInsertRows();
 
-    // Once we've added an alarm, start the timer
-    d->alarmTimer->start();
+    // Once we've added an alarm, start checking
+    d->startChecking();
 }
 
 void AlarmList::addAlarm(const QString& alarmName)
@@ -224,9 +244,9 @@ void AlarmList::removeAlarmByIndex(int index)
     Q_EMIT listChanged();
     endRemoveRows();
 
-    // When there are no more alarms, stop the timer
+    // When there are no more alarms, stop checking
     if(d->list.count() == 0) {
-        d->alarmTimer->stop();
+        d->stopChecking();
     }
 }
 
@@ -19,13 +19,21 @@
 #include "AppSettings.h"
 #include "AlarmList.h"
 #include "Alarm.h"
+#include "CommandFilesModel.h"
 #include "CommandPersistence.h"
 
 #include <KLocalizedString>
 
 #include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDir>
 #include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
 #include <QSettings>
+#include <QStandardPaths>
 #include <QTimer>
 
 class AppSettings::Private
@@ -42,6 +50,7 @@ public:
     bool idleMode = false;
     bool autoReconnect = true;
     bool alwaysSendToAll = false;
+    bool queueFollowsGear = false;
     QStringList idleCategories;
     int idleMinPause = 15;
     int idleMaxPause = 60;
@@ -55,7 +64,160 @@ public:
     QString activeAlarmName;
 
     QVariantMap commandFiles;
+    // What gets replicated of commandFiles (that is, everything but the contents)
+    CommandFilesModel* commandFilesModel{nullptr};
+    void setCommandFile(const QString& filename, const QVariantMap& fileMap) {
+        commandFiles[filename] = fileMap;
+        commandFilesModel->setFile(filename, fileMap);
+    }
+    // The parsed contents of the files in commandFiles. A file is only parsed the first time
+    // somebody asks for its commands, is then shared by everything loading commands from it,
+    // and is forgotten again when the file's contents are changed
+    QHash<QString, AppSettings::CommandFileData> commandFileData;
     bool isInitialized{false};
+
+    // The user's own command files each live in a file of their own in the commands directory,
+    // named after a hash of the file's name (as that can be anything at all), and the index
+    // holds the names of all of them, in the order they were added, along with everything
+    // the catalogue shows about them. That way starting up only means reading the index, and
+    // the files themselves are left alone until somebody wants their contents.
+    QStringList storedCommandFiles;
+
+    QString commandStorePath() const {
+        const QString path = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation).append(QLatin1String{"/commands"});
+        QDir directory{path};
+        if (!directory.exists() && !directory.mkpath(QLatin1String{"."})) {
+            qWarning() << "Failed to create the directory for storing command files in:" << path;
+            return QString{};
+        }
+        return path;
+    }
+
+    QString storedFilePath(const QString& filename) const {
+        const QByteArray hash = QCryptographicHash::hash(filename.toUtf8(), QCryptographicHash::Sha1).toHex();
+        return QString::fromUtf8("%1/%2.crumpet").arg(commandStorePath()).arg(QString::fromLatin1(hash));
+    }
+
+    QString indexPath() const {
+        return commandStorePath().append(QLatin1String{"/index.json"});
+    }
+
+    // Read the names of the stored files, and return the catalogue entries of those the index
+    // has them for (any others have to be read to find out what is in them)
+    QHash<QString, QVariantMap> readCommandIndex() {
+        QHash<QString, QVariantMap> entries;
+        QFile file(indexPath());
+        if (file.open(QIODevice::ReadOnly)) {
+            const QJsonArray index = QJsonDocument::fromJson(file.readAll()).array();
+            for (const QJsonValue& value : index) {
+                const QJsonObject entry = value.toObject();
+                const QString filename = entry.value(QLatin1String{"Name"}).toString();
+                storedCommandFiles << filename;
+                if (entry.contains(QLatin1String{"IsValid"})) {
+                    QVariantMap fileMap;
+                    fileMap[QLatin1String{"title"}] = entry.value(QLatin1String{"Title"}).toString();
+                    fileMap[QLatin1String{"description"}] = entry.value(QLatin1String{"Description"}).toString();
+                    fileMap[QLatin1String{"isEditable"}] = true;
+                    fileMap[QLatin1String{"isValid"}] = entry.value(QLatin1String{"IsValid"}).toBool();
+                    fileMap[QLatin1String{"hash"}] = entry.value(QLatin1String{"Hash"}).toString().toLatin1();
+                    entries[filename] = fileMap;
+                }
+            }
+        }
+        return entries;
+    }
+
+    bool writeCommandIndex() const {
+        QJsonArray index;
+        for (const QString& filename : storedCommandFiles) {
+            QJsonObject entry;
+            entry[QLatin1String{"Name"}] = filename;
+            // Files which are only just being moved into the store have not been looked at yet
+            if (commandFiles.contains(filename)) {
+                const QVariantMap fileMap = commandFiles.value(filename).toMap();
+                entry[QLatin1String{"Title"}] = fileMap.value(QLatin1String{"title"}).toString();
+                entry[QLatin1String{"Description"}] = fileMap.value(QLatin1String{"description"}).toString();
+                entry[QLatin1String{"IsValid"}] = fileMap.value(QLatin1String{"isValid"}).toBool();
+                entry[QLatin1String{"Hash"}] = QString::fromLatin1(fileMap.value(QLatin1String{"hash"}).toByteArray());
+            }
+            index.append(entry);
+        }
+        QSaveFile file(indexPath());
+        if (file.open(QIODevice::WriteOnly)) {
+            file.write(QJsonDocument(index).toJson(QJsonDocument::Compact));
+            return file.commit();
+        }
+        qWarning() << "Failed to write the index of stored command files";
+        return false;
+    }
+
+    bool storeCommandFile(const QString& filename, const QString& content) {
+        QSaveFile file(storedFilePath(filename));
+        if (!file.open(QIODevice::WriteOnly)) {
+            qWarning() << "Failed to open the stored version of the command file" << filename << "for writing";
+            return false;
+        }
+        file.write(content.toUtf8());
+        if (!file.commit()) {
+            qWarning() << "Failed to write the stored version of the command file" << filename;
+            return false;
+        }
+        if (!storedCommandFiles.contains(filename)) {
+            storedCommandFiles << filename;
+        }
+        // The title, description, or validity may well have changed along with the contents
+        return writeCommandIndex();
+    }
+
+    void removeStoredCommandFile(const QString& filename) {
+        if (storedCommandFiles.removeAll(filename) > 0) {
+            QFile::remove(storedFilePath(filename));
+            writeCommandIndex();
+        }
+    }
+
+    QString readStoredCommandFile(const QString& filename) const {
+        QString content;
+        QFile file(storedFilePath(filename));
+        if (file.open(QIODevice::ReadOnly) && file.size() > 0) {
+            // Map the file rather than reading it, so we don't end up holding a copy of the raw
+            // bytes as well as the string we decode from them
+            uchar* data = file.map(0, file.size());
+            if (data) {
+                content = QString::fromUtf8(reinterpret_cast<const char*>(data), file.size());
+                file.unmap(data);
+            } else {
+                content = QString::fromUtf8(file.readAll());
+            }
+        }
+        return content;
+    }
+
+    // Remove the compiled version of a file's old contents from the cache, unless some other
+    // file still has those exact same contents (which is the case for duplicated files)
+    void releaseCachedDocument(const QByteArray& hash, const QString& filename) const {
+        if (hash.isEmpty()) {
+            return;
+        }
+        for (auto it = commandFiles.cbegin(); it != commandFiles.cend(); ++it) {
+            if (it.key() != filename && it.value().toMap().value(QLatin1String{"hash"}).toByteArray() == hash) {
+                return;
+            }
+        }
+        CommandPersistence::evictCached(hash);
+    }
+
+    // The contents of the given command file, which for stored files are read the first time they are needed
+    QString contentsOf(const QString& filename) {
+        static const QLatin1String contentsKey{"contents"};
+        QVariantMap fileMap = commandFiles.value(filename).toMap();
+        if (!fileMap.contains(contentsKey) && storedCommandFiles.contains(filename)) {
+            fileMap[contentsKey] = readStoredCommandFile(filename);
+            // Nothing the model shows has changed, so it does not need to hear about this
+            commandFiles[filename] = fileMap;
+        }
+        return fileMap.value(contentsKey).toString();
+    }
 };
 
 static const QLatin1Char semicolon{';'};
@@ -70,6 +232,7 @@ AppSettings::AppSettings(QObject* parent)
     d->idleMode = settings.value("idleMode", d->idleMode).toBool();
     d->autoReconnect = settings.value("autoReconnect", d->autoReconnect).toBool();
     d->alwaysSendToAll = settings.value("alwaysSendToAll", d->alwaysSendToAll).toBool();
+    d->queueFollowsGear = settings.value("queueFollowsGear", d->queueFollowsGear).toBool();
     d->idleCategories = settings.value("idleCategories", d->idleCategories).toStringList();
     d->idleMinPause = settings.value("idleMinPause", d->idleMinPause).toInt();
     d->idleMaxPause = settings.value("idleMaxPause", d->idleMaxPause).toInt();
@@ -107,6 +270,7 @@ AppSettings::AppSettings(QObject* parent)
     connect(d->alarmList, &AlarmList::alarmExisted, this, &AppSettings::alarmExisted);
     connect(d->alarmList, &AlarmList::alarmNotExisted, this, &AppSettings::alarmNotExisted);
 
+    d->commandFilesModel = new CommandFilesModel(this);
     const QStringList builtInCrumpets{QLatin1String{":/commands/eargear-base.crumpet"}, QLatin1String{":/commands/eargear2-base.crumpet"}, QLatin1String{":/commands/digitail-builtin.crumpet"}, QLatin1String{":/commands/mitail-builtin.crumpet"}, QLatin1String{":/commands/mitail-lights-builtin.crumpet"}, QLatin1String{":/commands/mitailmini-builtin.crumpet"}, QLatin1String{":/commands/mitailmini-lights-builtin.crumpet"}};
     for (const QString& filename : builtInCrumpets) {
         QString data;
@@ -119,16 +283,50 @@ AppSettings::AppSettings(QObject* parent)
         }
         file.close();
         addCommandFile(filename, data);
-        QVariantMap fileMap = d->commandFiles[filename].toMap();
+        QVariantMap fileMap = d->commandFiles.value(filename).toMap();
         fileMap[QLatin1String{"isEditable"}] = false;
-        d->commandFiles[filename] = fileMap;
+        d->setCommandFile(filename, fileMap);
+    }
+    // Everything the catalogue needs about the stored files is in the index, so the files
+    // themselves are only read once somebody wants their contents (see Private::contentsOf())
+    const QHash<QString, QVariantMap> indexedCommandFiles = d->readCommandIndex();
+    for (const QString& filename : std::as_const(d->storedCommandFiles)) {
+        const auto indexed = indexedCommandFiles.constFind(filename);
+        if (indexed != indexedCommandFiles.constEnd()) {
+            d->setCommandFile(filename, indexed.value());
+        }
     }
+    // User command files used to be kept in the settings file, so move any which are still
+    // there across to the command store, and forget each of them as soon as it is safely
+    // stored. Anything already in the store is newer than what was left behind in the
+    // settings, so that is kept, and the old copy simply dropped.
     settings.beginGroup("CrumpetFiles");
-    for (const QString& filename : settings.childKeys()) {
-        addCommandFile(filename, settings.value(filename).toString());
+    const QStringList legacyCommandFiles = settings.childKeys();
+    for (const QString& filename : legacyCommandFiles) {
+        if (d->storedCommandFiles.contains(filename) || d->storeCommandFile(filename, settings.value(filename).toString())) {
+            settings.remove(filename);
+        }
     }
     settings.endGroup();
-    Q_EMIT commandFilesChanged(d->commandFiles);
+    // Anything the index knows nothing about (such as the files just moved across) has to be
+    // read to find out, and the index then updated so we don't have to do that again
+    bool indexIncomplete{false};
+    for (const QString& filename : std::as_const(d->storedCommandFiles)) {
+        if (!d->commandFiles.contains(filename)) {
+            addCommandFile(filename, d->readStoredCommandFile(filename));
+            indexIncomplete = true;
+        }
+    }
+    if (indexIncomplete) {
+        d->writeCommandIndex();
+    }
+    // Clear out anything left in the compiled command cache by files which have since been
+    // changed or removed
+    QSet<QByteArray> commandFileHashes;
+    for (auto it = d->commandFiles.cbegin(); it != d->commandFiles.cend(); ++it) {
+        commandFileHashes << it.value().toMap().value(QLatin1String{"hash"}).toByteArray();
+    }
+    CommandPersistence::pruneCache(commandFileHashes);
 
     d->isInitialized = true;
 }
@@ -242,6 +440,21 @@ void AppSettings::setAlwaysSendToAll(bool alwaysSendToAll)
     }
 }
 
+bool AppSettings::queueFollowsGear() const
+{
+    return d->queueFollowsGear;
+}
+
+void AppSettings::setQueueFollowsGear(bool queueFollowsGear)
+{
+    if (queueFollowsGear != d->queueFollowsGear) {
+        d->queueFollowsGear = queueFollowsGear;
+        QSettings settings;
+        settings.setValue("queueFollowsGear", d->queueFollowsGear);
+        Q_EMIT queueFollowsGearChanged(queueFollowsGear);
+    }
+}
+
 QStringList AppSettings::idleCategories() const
 {
     return d->idleCategories;
@@ -538,9 +751,14 @@ void AppSettings::shutDownService()
     qApp->quit();
 }
 
-QVariantMap AppSettings::commandFiles() const
+QAbstractItemModel* AppSettings::commandFiles() const
+{
+    return d->commandFilesModel;
+}
+
+void AppSettings::requestCommandFileContents(const QString& filename)
 {
-    return d->commandFiles;
+    Q_EMIT commandFileContents(filename, d->contentsOf(filename));
 }
 
 static const QLatin1String emptyString{""};
@@ -552,20 +770,31 @@ void AppSettings::addCommandFile(const QString& filename, const QString& content
     fileMap[QLatin1String{"description"}] = emptyString;
     fileMap[QLatin1String{"isEditable"}] = true;
     fileMap[QLatin1String{"isValid"}] = false;
-    d->commandFiles[filename] = fileMap;
+    d->setCommandFile(filename, fileMap);
     setCommandFileContents(filename, content);
 }
 
+void AppSettings::duplicateCommandFile(const QString& filename, const QString& newFilename)
+{
+    // Done here, rather than by the UI, so the contents don't have to go there and back again
+    if (d->commandFiles.contains(filename) && !d->commandFiles.contains(newFilename)) {
+        addCommandFile(newFilename, d->contentsOf(filename));
+    }
+}
+
 void AppSettings::removeCommandFile(const QString& filename)
 {
-    QVariantMap fileMap = d->commandFiles[filename].toMap();
+    QVariantMap fileMap = d->commandFiles.value(filename).toMap();
     if (fileMap[QLatin1String{"isEditable"}].toBool()) {
         d->commandFiles.remove(filename);
+        d->commandFilesModel->removeFile(filename);
+        d->commandFileData.remove(filename);
+        d->removeStoredCommandFile(filename);
+        d->releaseCachedDocument(fileMap.value(QLatin1String{"hash"}).toByteArray(), filename);
         QFile theFile{filename};
         if (theFile.exists()) {
             theFile.remove();
         }
-        Q_EMIT commandFilesChanged(d->commandFiles);
     }
 }
 
@@ -577,40 +806,97 @@ void AppSettings::setCommandFileContents(const QString& filename, const QString&
 // [QString (Editable)] => bool - Whether or not the contents can be changed (false when the file is a built-in)
 // [QString (Valid)] => bool - Whether or not the contents are valid json/crumpet
 
-    QVariantMap fileMap = d->commandFiles[filename].toMap();
+    // A file only has a hash once its contents have actually been set (and stored), so a newly
+    // added file always goes through here, even if it is empty, or it would never be stored
+    QVariantMap fileMap = d->commandFiles.value(filename).toMap();
+    if (fileMap.contains(QLatin1String{"hash"}) && d->contentsOf(filename) == content) {
+        // Nothing has changed, so whatever we already know about the file is still good
+        return;
+    }
     if (fileMap[QLatin1String{"isEditable"}].toBool()) {
-        // Don't store the things back if we're not yet initialised, or we'll just be writing stuff we
-        // just read, which seems silly...
-        if (d->isInitialized) {
-            // Store into the settings instance - we will want to make this file editing later
-            // but for now it allows us to not ask for file access permissions
-            QSettings settings;
-            settings.beginGroup("CrumpetFiles");
-            settings.setValue(filename, content);
-            settings.endGroup();
-            settings.sync();
-        }
-
+        const QByteArray previousHash = fileMap.value(QLatin1String{"hash"}).toByteArray();
+        const QByteArray hash = CommandPersistence::documentHash(content);
+        fileMap[QLatin1String{"hash"}] = hash;
         fileMap[QLatin1String{"contents"}] = content;
         fileMap[QLatin1String{"isValid"}] = false;
 
+        // All the catalogue needs is the title and description, so leave the commands until
+        // somebody actually wants them (see commandFileData())
         CommandPersistence persistence;
-        persistence.deserialize(content);
-        if (persistence.error().isEmpty()) {
+        if (persistence.readHeader(content, hash)) {
             fileMap[QLatin1String{"title"}] = persistence.title();
             fileMap[QLatin1String{"description"}] = persistence.description();
             fileMap[QLatin1String{"isValid"}] = true;
         }
-        d->commandFiles[filename] = fileMap;
-        Q_EMIT commandFilesChanged(d->commandFiles);
+        d->commandFileData.remove(filename);
+        d->setCommandFile(filename, fileMap);
+        if (previousHash != hash) {
+            d->releaseCachedDocument(previousHash, filename);
+        }
+
+        // Don't store the things back if we're not yet initialised, or we'll just be writing stuff we
+        // just read, which seems silly...
+        if (d->isInitialized) {
+            // Only this one file gets written (along with the index), rather than everything else
+            d->storeCommandFile(filename, content);
+        }
     }
 }
 
+AppSettings::CommandFileData AppSettings::commandFileData(const QString& filename)
+{
+    auto it = d->commandFileData.constFind(filename);
+    if (it == d->commandFileData.constEnd()) {
+        CommandFileData data;
+        if (!d->commandFiles.contains(filename)) {
+            data.error = QString::fromUtf8("There is no command file named %1").arg(filename);
+            return data;
+        }
+        const QString contents = d->contentsOf(filename);
+        QVariantMap fileMap = d->commandFiles.value(filename).toMap();
+        CommandPersistence persistence;
+        // The hash was worked out when the contents were set, so there is no need to do that again
+        persistence.deserializeCached(contents, fileMap.value(QLatin1String{"hash"}).toByteArray());
+        data.error = persistence.error();
+        if (persistence.error().isEmpty()) {
+            data.isValid = true;
+            data.commands = persistence.commands();
+            data.shorthands = persistence.shorthands();
+        }
+        // The header scan only looks at the outline of the file, so the full parse is the
+        // one which gets to decide whether it is actually usable
+        if (fileMap[QLatin1String{"isValid"}].toBool() != data.isValid) {
+            fileMap[QLatin1String{"isValid"}] = data.isValid;
+            d->setCommandFile(filename, fileMap);
+            if (d->storedCommandFiles.contains(filename)) {
+                d->writeCommandIndex();
+            }
+        }
+        it = d->commandFileData.insert(filename, data);
+    }
+    return it.value();
+}
+
 void AppSettings::renameCommandFile(const QString& filename, const QString& newFilename)
 {
-    QVariantMap fileMap = d->commandFiles.take(filename).toMap();
-    if (fileMap[QLatin1String{"isEditable"}].toBool()) {
-        d->commandFiles[newFilename] = fileMap;
-        Q_EMIT commandFilesChanged(d->commandFiles);
+    QVariantMap fileMap = d->commandFiles.value(filename).toMap();
+    if (fileMap[QLatin1String{"isEditable"}].toBool() && !d->commandFiles.contains(newFilename)) {
+        const QString contents = d->contentsOf(filename);
+        // Only move anything over once the file is safely stored under its new name, or we would
+        // end up with the old stored file turning up again as a separate file on the next start
+        if (!d->storeCommandFile(newFilename, contents)) {
+            qWarning() << "Failed to store the command file" << filename << "under its new name" << newFilename << "so it keeps its old name";
+            d->removeStoredCommandFile(newFilename);
+            return;
+        }
+        fileMap[QLatin1String{"contents"}] = contents;
+        d->commandFiles.remove(filename);
+        d->commandFilesModel->removeFile(filename);
+        d->setCommandFile(newFilename, fileMap);
+        // This also writes the index again, now with the catalogue entry for the new name
+        d->removeStoredCommandFile(filename);
+        if (d->commandFileData.contains(filename)) {
+            d->commandFileData[newFilename] = d->commandFileData.take(filename);
+        }
     }
 }
@@ -21,6 +21,7 @@
 
 #include <QObject>
 #include "rep_AppSettingsProxy_source.h"
+#include "CommandPersistence.h"
 
 class AlarmList;
 
@@ -49,6 +50,9 @@ public:
     bool alwaysSendToAll() const override;
     void setAlwaysSendToAll(bool alwaysSendToAll) override;
 
+    bool queueFollowsGear() const override;
+    void setQueueFollowsGear(bool queueFollowsGear) override;
+
     QStringList idleCategories() const override;
     void setIdleCategories(QStringList newCategories) override;
     void addIdleCategory(const QString& category) override;
@@ -88,21 +92,48 @@ public:
     void setLanguageOverride ( QString languageOverride ) override;
 
     /**
-     * A map of the available command files, with the following structure:
-     * [QString (filename)] => QVariantMap [QString (title)] => QString - A short title for the file as interpreted from the contents on load
-     *                                     [QString (description)] => QString - The long-form description of the file as interpreted from the contents on load
-     *                                     [QString (contents)] => QString - The actual contents of the file
-     *                                     [QString (isEditable)] => bool - Whether or not the contents can be changed (false when the file is a built-in)
-     *                                     [QString (isValid)] => bool - Whether or not the contents are valid json/crumpet
+     * The available command files, one row for each, with the roles filename, title
+     * (a short title for the file as interpreted from the contents on load), description
+     * (the long-form description of the file as interpreted from the contents on load),
+     * isEditable (false when the file is a built-in), and isValid (whether or not the
+     * contents are valid json/crumpet). The contents are not in here, see
+     * requestCommandFileContents(const QString&)
+     */
+    QAbstractItemModel* commandFiles() const override;
+    /**
+     * Ask for the contents of a command file, which will be sent out through the
+     * commandFileContents signal
+     * @param filename The name of the file
      */
-    QVariantMap commandFiles() const override;
+    void requestCommandFileContents(const QString& filename) override;
     void addCommandFile(const QString& filename, const QString& content) override;
+    // Add a new file with the same contents as the existing one (which may be a built-in)
+    void duplicateCommandFile(const QString& filename, const QString& newFilename) override;
     // Changing and removing things not marked as Editable will fail silently (and commandFiles will simply not change)
     void removeCommandFile(const QString& filename) override;
     // Changing the content will reset the title and description, but only if it is valid (or they will be retained in the current session)
     void setCommandFileContents(const QString& filename, const QString& content) override;
     void renameCommandFile(const QString& filename, const QString& newFilename) override;
 
+    /**
+     * The commands and shorthands from one of the command files, already parsed
+     */
+    struct CommandFileData {
+        bool isValid{false};
+        // If the file could not be loaded, this describes why
+        QString error;
+        CommandInfoList commands;
+        CommandShorthandList shorthands;
+    };
+    /**
+     * Get the parsed contents of the given command file. Each file is only parsed the first
+     * time this is called for it (and again after its contents change), and everybody asking
+     * for it after that shares the same data.
+     * @param filename The name of the file (as used in commandFiles())
+     * @return The commands and shorthands in the file (or an invalid result, if there is no such file)
+     */
+    CommandFileData commandFileData(const QString& filename);
+
     void shutDownService() override;
 private:
     class Private;
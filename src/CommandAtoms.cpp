@@ -0,0 +1,72 @@
+/*
+ *   Copyright 2019 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#include "CommandAtoms.h"
+
+#include <QHash>
+#include <QStringList>
+
+namespace {
+    struct AtomTable {
+        AtomTable()
+        {
+            strings << QString{};
+            atoms.insert(QString{}, 0);
+        }
+        QHash<QString, CommandAtoms::Atom> atoms;
+        QStringList strings;
+    };
+
+    AtomTable& atomTable()
+    {
+        static AtomTable table;
+        return table;
+    }
+}
+
+CommandAtoms::Atom CommandAtoms::intern(const QString& command)
+{
+    AtomTable& table = atomTable();
+    const auto it = table.atoms.constFind(command);
+    if (it != table.atoms.constEnd()) {
+        return it.value();
+    }
+    const Atom atom = Atom(table.strings.count());
+    table.strings << command;
+    table.atoms.insert(command, atom);
+    return atom;
+}
+
+CommandAtoms::Atom CommandAtoms::find(const QString& command)
+{
+    const AtomTable& table = atomTable();
+    return table.atoms.value(command, 0);
+}
+
+QString CommandAtoms::string(Atom atom)
+{
+    const AtomTable& table = atomTable();
+    if (atom > 0 && atom < table.strings.count()) {
+        return table.strings.at(atom);
+    }
+    return QString{};
+}
+
+int CommandAtoms::count()
+{
+    return int(atomTable().strings.count());
+}
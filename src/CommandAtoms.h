@@ -0,0 +1,66 @@
+/*
+ *   Copyright 2019 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#ifndef COMMANDATOMS_H
+#define COMMANDATOMS_H
+
+#include <QString>
+
+/**
+ * @brief A table of all the distinct command strings the service knows about
+ *
+ * Each distinct command string is given a small integer ID (an atom) the first
+ * time it is seen, which is usually when a .crumpet file is loaded. Inside the
+ * service, commands can then be matched up by comparing (and hashing) those IDs,
+ * rather than the strings, and the strings are only needed again when talking
+ * to the devices, or passing things on to the UI.
+ *
+ * Atoms are never removed from the table, so an ID stays valid (and keeps meaning
+ * the same command) for as long as the service runs. The empty string is always
+ * atom zero, which also serves as "no command".
+ */
+class CommandAtoms
+{
+public:
+    using Atom = int;
+
+    /**
+     * Get the atom for the given command, adding it to the table if it is not already there
+     * @param command The command string
+     * @return The atom for the command (zero for the empty string)
+     */
+    static Atom intern(const QString& command);
+    /**
+     * Get the atom for the given command, without adding it to the table
+     * @param command The command string
+     * @return The atom for the command, or zero if it is not in the table
+     */
+    static Atom find(const QString& command);
+    /**
+     * @param atom An atom previously returned by intern()
+     * @return The command string the atom stands for, or an empty string for an unknown atom
+     */
+    static QString string(Atom atom);
+    /**
+     * @return The number of atoms in the table (including the empty one)
+     */
+    static int count();
+private:
+    CommandAtoms() = delete;
+};
+
+#endif//COMMANDATOMS_H
@@ -0,0 +1,148 @@
+/*
+ *   Copyright 2019 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#include "CommandFilesModel.h"
+
+class CommandFilesModel::Private
+{
+public:
+    Private() {}
+    struct File {
+        QString filename;
+        QString title;
+        QString description;
+        bool isEditable{false};
+        bool isValid{false};
+    };
+    QList<File> files;
+    // The row of each file, so finding one does not mean going through the whole list
+    QHash<QString, int> rows;
+
+    int rowOf(const QString& filename) const {
+        return rows.value(filename, -1);
+    }
+};
+
+CommandFilesModel::CommandFilesModel(QObject* parent)
+    : QAbstractListModel(parent)
+    , d(new Private)
+{
+}
+
+CommandFilesModel::~CommandFilesModel()
+{
+    delete d;
+}
+
+QHash<int, QByteArray> CommandFilesModel::roleNames() const
+{
+    static const QHash<int, QByteArray> roles{
+        {Filename, "filename"},
+        {Title, "title"},
+        {Description, "description"},
+        {IsEditable, "isEditable"},
+        {IsValid, "isValid"}};
+    return roles;
+}
+
+QVariant CommandFilesModel::data(const QModelIndex& index, int role) const
+{
+    QVariant value;
+    if (checkIndex(index, CheckIndexOption::IndexIsValid | CheckIndexOption::ParentIsInvalid)) {
+        const Private::File& file = d->files.at(index.row());
+        switch(role) {
+            case Filename:
+                value = file.filename;
+                break;
+            case Title:
+                value = file.title;
+                break;
+            case Description:
+                value = file.description;
+                break;
+            case IsEditable:
+                value = file.isEditable;
+                break;
+            case IsValid:
+                value = file.isValid;
+                break;
+            default:
+                break;
+        }
+    }
+    return value;
+}
+
+int CommandFilesModel::rowCount(const QModelIndex& parent) const
+{
+    if (parent.isValid()) {
+        return 0;
+    }
+    return d->files.count();
+}
+
+void CommandFilesModel::setFile(const QString& filename, const QVariantMap& fileMap)
+{
+    Private::File file;
+    file.filename = filename;
+    file.title = fileMap.value(QLatin1String{"title"}).toString();
+    file.description = fileMap.value(QLatin1String{"description"}).toString();
+    file.isEditable = fileMap.value(QLatin1String{"isEditable"}).toBool();
+    file.isValid = fileMap.value(QLatin1String{"isValid"}).toBool();
+    const int row = d->rowOf(filename);
+    if (row < 0) {
+        beginInsertRows(QModelIndex(), d->files.count(), d->files.count());
+        d->rows.insert(filename, d->files.count());
+        d->files << file;
+        endInsertRows();
+    } else {
+        Private::File& existing = d->files[row];
+        QList<int> changedRoles;
+        if (existing.title != file.title) {
+            changedRoles << Title;
+        }
+        if (existing.description != file.description) {
+            changedRoles << Description;
+        }
+        if (existing.isEditable != file.isEditable) {
+            changedRoles << IsEditable;
+        }
+        if (existing.isValid != file.isValid) {
+            changedRoles << IsValid;
+        }
+        if (!changedRoles.isEmpty()) {
+            existing = file;
+            const QModelIndex idx = index(row);
+            Q_EMIT dataChanged(idx, idx, changedRoles);
+        }
+    }
+}
+
+void CommandFilesModel::removeFile(const QString& filename)
+{
+    const int row = d->rowOf(filename);
+    if (row > -1) {
+        beginRemoveRows(QModelIndex(), row, row);
+        d->files.removeAt(row);
+        d->rows.remove(filename);
+        // Everything after the removed file moves up a row
+        for (int i = row; i < d->files.count(); ++i) {
+            d->rows[d->files.at(i).filename] = i;
+        }
+        endRemoveRows();
+    }
+}
@@ -0,0 +1,68 @@
+/*
+ *   Copyright 2019 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#ifndef COMMANDFILESMODEL_H
+#define COMMANDFILESMODEL_H
+
+#include <QAbstractListModel>
+#include <QVariantMap>
+
+/**
+ * @brief A list of the command files known to AppSettings, without their contents
+ *
+ * This is what gets replicated to the UI, one row per file, so that changing one file
+ * only sends out the change to that one row. The contents are left out entirely, and
+ * can be asked for by name when they are actually needed.
+ * @see AppSettings::requestCommandFileContents(const QString&)
+ */
+class CommandFilesModel : public QAbstractListModel
+{
+    Q_OBJECT
+public:
+    explicit CommandFilesModel(QObject* parent = nullptr);
+    ~CommandFilesModel() override;
+
+    enum Roles {
+        Filename = Qt::UserRole + 1,
+        Title,
+        Description,
+        IsEditable,
+        IsValid
+    };
+
+    QHash< int, QByteArray > roleNames() const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+
+    /**
+     * Add the file to the model, or update it if it is already there. Only the roles
+     * which actually changed are reported.
+     * @param filename The name of the file
+     * @param fileMap The description of the file, as held by AppSettings (any contents in it are ignored)
+     */
+    void setFile(const QString& filename, const QVariantMap& fileMap);
+    /**
+     * Remove the file from the model (if it is there)
+     * @param filename The name of the file
+     */
+    void removeFile(const QString& filename);
+private:
+    class Private;
+    Private* d;
+};
+
+#endif//COMMANDFILESMODEL_H
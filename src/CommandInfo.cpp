@@ -23,10 +23,12 @@ CommandInfo::CommandInfo()
 CommandInfo::CommandInfo(const CommandInfo& other)
     : name(other.name)
     , command(other.command)
+    , commandID(other.commandID)
     , category(other.category)
     , duration(other.duration)
     , minimumCooldown(other.minimumCooldown)
     , group(other.group)
+    , weight(other.weight)
     , isRunning(other.isRunning)
     , isAvailable(other.isAvailable)
 { }
@@ -34,10 +36,12 @@ CommandInfo::CommandInfo(const CommandInfo& other)
 CommandInfo::CommandInfo(CommandInfo && other) noexcept
     : name(std::move(other.name))
     , command(std::move(other.command))
+    , commandID(std::move(other.commandID))
     , category(std::move(other.category))
     , duration(std::move(other.duration))
     , minimumCooldown(std::move(other.minimumCooldown))
     , group(std::move(other.group))
+    , weight(std::move(other.weight))
     , isRunning(std::move(other.isRunning))
     , isAvailable(std::move(other.isAvailable))
 {
@@ -47,10 +51,12 @@ CommandInfo& CommandInfo::operator=(CommandInfo && other) noexcept
 {
     name = std::move(other.name);
     command = std::move(other.command);
+    commandID = std::move(other.commandID);
     category = std::move(other.category);
     duration = std::move(other.duration);
     minimumCooldown = std::move(other.minimumCooldown);
     group = std::move(other.group);
+    weight = std::move(other.weight);
     isRunning = std::move(other.isRunning);
     isAvailable = std::move(other.isAvailable);
     return *this;
@@ -60,10 +66,12 @@ CommandInfo& CommandInfo::operator=(const CommandInfo& other)
 {
     name = other.name;
     command = other.command;
+    commandID = other.commandID;
     category = other.category;
     duration = other.duration;
     minimumCooldown = other.minimumCooldown;
     group = other.group;
+    weight = other.weight;
     isRunning = other.isRunning;
     isAvailable = other.isAvailable;
     return *this;
@@ -76,10 +84,12 @@ void CommandInfo::clear()
 {
     name.clear();
     command.clear();
+    commandID = 0;
     category.clear();
     duration = 0;
     minimumCooldown = 0;
     group = 0;
+    weight = 1;
     isRunning = false;
     isAvailable = true;
 }
@@ -89,7 +99,7 @@ bool CommandInfo::compare(const CommandInfo& other) const
     // Not comparing isRunning and isAvailable, as that isn't necessarily quite as true...
     return (
         name == other.name &&
-        command == other.command &&
+        sameCommand(other) &&
         category == other.category &&
         duration == other.duration &&
         minimumCooldown == other.minimumCooldown &&
@@ -102,12 +112,45 @@ bool CommandInfo::equivalent(const CommandInfo &other) const
     // Only checking the name, command, category, and group, as duration and cooldown is different per-device. Used for grouping purposes
     return (
         name == other.name &&
-        command == other.command &&
+        sameCommand(other) &&
         category == other.category &&
         group == other.group
     );
 }
 
+CommandInfo::EquivalenceKey CommandInfo::equivalenceKey() const
+{
+    return EquivalenceKey{name, id(), category, group};
+}
+
+CommandAtoms::Atom CommandInfo::internCommand()
+{
+    commandID = CommandAtoms::intern(command);
+    return commandID;
+}
+
+CommandAtoms::Atom CommandInfo::id() const
+{
+    if (commandID > 0 || command.isEmpty()) {
+        return commandID;
+    }
+    // Only commands which are loaded get added to the table (see internCommand()), so anything
+    // else asked about here does not grow it
+    return CommandAtoms::find(command);
+}
+
+bool CommandInfo::sameCommand(const CommandInfo& other) const
+{
+    const CommandAtoms::Atom ours = id();
+    const CommandAtoms::Atom theirs = other.id();
+    // A command which is not in the table cannot be the same as one which is, but two which
+    // are both unknown have to be compared the slow way
+    if (ours > 0 || theirs > 0) {
+        return ours == theirs;
+    }
+    return command == other.command;
+}
+
 bool CommandInfo::isValid() const
 {
     if (name.isEmpty() || command.isEmpty() || category.isEmpty() || duration < 1) {
@@ -18,7 +18,11 @@
 #ifndef COMMANDINFO_H
 #define COMMANDINFO_H
 
+#include <QHashFunctions>
 #include <QList>
+#include <QString>
+
+#include "CommandAtoms.h"
 
 class CommandInfo {
 public:
@@ -31,17 +35,54 @@ public:
 
     QString name;
     QString command;
+    // The atom for command (see CommandAtoms). This is filled in when commands are loaded,
+    // but if you change command, remember to call internCommand() to update it.
+    CommandAtoms::Atom commandID{0};
     QString category;
     int duration{0}; // milliseconds
     int minimumCooldown{0}; // milliseconds
     int group{0}; // A super-category grouping (no two commands should both be available, if they have the same group and belong to the same device)
+    int weight{1}; // How likely casual mode is to pick this command, relative to the others (zero means never)
 
     bool isRunning{false};
     bool isAvailable{true};
 
     void clear();
+    /**
+     * Set commandID to the atom for the current command string
+     * @return The new commandID
+     */
+    CommandAtoms::Atom internCommand();
+    /**
+     * @return The atom for the command, or zero if the command is not in the table
+     * @see internCommand()
+     */
+    CommandAtoms::Atom id() const;
+    /**
+     * Whether the other command has the same command string as this one (using the atoms
+     * where they are known)
+     */
+    bool sameCommand(const CommandInfo& other) const;
     bool compare(const CommandInfo& other) const;
     bool equivalent(const CommandInfo& other) const;
+    /**
+     * The parts of a command which are used to decide whether two commands are
+     * equivalent, in a form which can be used as the key in a hash
+     */
+    struct EquivalenceKey {
+        QString name;
+        CommandAtoms::Atom command{0};
+        QString category;
+        int group{0};
+        bool operator==(const EquivalenceKey& other) const {
+            return command == other.command && group == other.group && name == other.name && category == other.category;
+        }
+    };
+    /**
+     * Two commands are equivalent exactly when their equivalence keys are equal
+     * @see equivalent(const CommandInfo& other) const
+     */
+    EquivalenceKey equivalenceKey() const;
     /**
      * Returns true if name, command, category, and duration are all set, otherwise false
      */
@@ -49,4 +90,9 @@ public:
 };
 typedef QList<CommandInfo> CommandInfoList;
 
+inline size_t qHash(const CommandInfo::EquivalenceKey& key, size_t seed = 0)
+{
+    return qHashMulti(seed, key.name, key.command, key.category, key.group);
+}
+
 #endif//COMMANDINFO_H
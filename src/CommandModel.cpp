@@ -23,6 +23,9 @@
 
 #include <QRandomGenerator>
 #include <QMutableVectorIterator>
+#include <QSet>
+
+#include <algorithm>
 
 class CommandModel::Private
 {
@@ -37,180 +40,409 @@ public:
         ~Entry() { }
         CommandInfo command;
         QList<GearBase*> devices;
+        // The row the entry is on in the model
+        int row{-1};
+        // What we know of this command on each of the devices, as the device last told us
+        // about it, so working out the state of the entry never means looking through the
+        // devices' own lists of commands
+        struct DeviceState {
+            int duration{0};
+            int minimumCooldown{0};
+            bool isRunning{false};
+            // Whether the command is available on the device, and the device is connected
+            bool isAvailable{false};
+        };
+        QHash<GearBase*, DeviceState> deviceStates;
+        // How many of the devices are running the command, and have it available
+        int runningCount{0};
+        int availableCount{0};
     };
     QVector<Entry*> commands;
+    // Indexes into the above, which need to be kept up to date whenever an entry is added
+    // or removed. As entries are only ever added to the end of the list, the entries for
+    // each command are listed in the same order as they are in the list of commands.
+    QHash<CommandAtoms::Atom, QList<Entry*>> byCommand;
+    QHash<CommandInfo::EquivalenceKey, Entry*> byEquivalenceKey;
+    QHash<QString, QList<Entry*>> byCategory;
+
+    // Random commands (for casual mode) are picked using a table set up for the alias method
+    // (Vose's version), which takes the commands' weights into account, and once the table is
+    // built, picks a command in constant time. The table is built for one set of categories at
+    // a time, and is thrown away whenever an entry is added or removed.
+    struct Sampler {
+        QStringList categories;
+        QList<const Entry*> entries;
+        QList<double> probabilities;
+        QList<int> aliases;
+        bool isValid{false};
+    };
+    Sampler sampler;
+    // The most recent picks, newest first, which we try not to pick again straight away
+    QList<const Entry*> recentPicks;
+    static constexpr int noRepeatWindow{2};
+    // How many times we try for something that was not picked recently, before giving up and
+    // going with whatever we got (which can happen if the recent ones weigh a lot more)
+    static constexpr int noRepeatAttempts{8};
+    // For each device, the entry for each of the rows in the device's own command model, so
+    // a change to one of the device's rows can be passed straight on to the right entry
+    QHash<GearBase*, QList<Entry*>> deviceRows;
+
+    void indexEntry(Entry* entry) {
+        byCommand[entry->command.id()].append(entry);
+        byEquivalenceKey.insert(entry->command.equivalenceKey(), entry);
+        byCategory[entry->command.category].append(entry);
+        sampler.isValid = false;
+    }
+
+    void unindexEntry(Entry* entry) {
+        auto it = byCommand.find(entry->command.id());
+        if (it != byCommand.end()) {
+            it.value().removeOne(entry);
+            if (it.value().isEmpty()) {
+                byCommand.erase(it);
+            }
+        }
+        byEquivalenceKey.remove(entry->command.equivalenceKey());
+        auto category = byCategory.find(entry->command.category);
+        if (category != byCategory.end()) {
+            category.value().removeOne(entry);
+            if (category.value().isEmpty()) {
+                byCategory.erase(category);
+            }
+        }
+        recentPicks.removeAll(entry);
+        sampler.isValid = false;
+    }
 
-    // Update the duration of the given entry's contained command to be whatever is the longest duration for this command in all the entry's devices
-    void updateEntryDurations(Entry *entry) {
+    void buildSampler(const QStringList& categories) {
+        sampler = Sampler{};
+        sampler.categories = categories;
+        QList<int> weights;
+        auto addEntry = [this, &weights](const Entry* entry) {
+            if (entry->command.weight > 0) {
+                sampler.entries << entry;
+                weights << entry->command.weight;
+            }
+        };
+        if (categories.isEmpty()) {
+            for (const Entry* entry : std::as_const(commands)) {
+                addEntry(entry);
+            }
+        } else {
+            QSet<QString> seen;
+            for (const QString& category : categories) {
+                if (!seen.contains(category)) {
+                    seen.insert(category);
+                    const auto entries = byCategory.constFind(category);
+                    if (entries != byCategory.constEnd()) {
+                        for (const Entry* entry : entries.value()) {
+                            addEntry(entry);
+                        }
+                    }
+                }
+            }
+        }
+        const int count = int(sampler.entries.count());
+        qint64 totalWeight{0};
+        for (int weight : std::as_const(weights)) {
+            totalWeight += weight;
+        }
+        sampler.probabilities.fill(1.0, count);
+        sampler.aliases.fill(0, count);
+        // Scale the weights so they average out at one, and then pair up each of the ones below
+        // one with one above it, which makes up the rest of its column
+        QList<double> scaled(count);
+        QList<int> small;
+        QList<int> large;
+        for (int i = 0; i < count; ++i) {
+            scaled[i] = double(weights.at(i)) * count / totalWeight;
+            if (scaled.at(i) < 1.0) {
+                small << i;
+            } else {
+                large << i;
+            }
+        }
+        while (!small.isEmpty() && !large.isEmpty()) {
+            const int less = small.takeLast();
+            const int more = large.takeLast();
+            sampler.probabilities[less] = scaled.at(less);
+            sampler.aliases[less] = more;
+            scaled[more] = (scaled.at(more) + scaled.at(less)) - 1.0;
+            if (scaled.at(more) < 1.0) {
+                small << more;
+            } else {
+                large << more;
+            }
+        }
+        // Anything left over is (give or take rounding errors) a full column on its own,
+        // which is what the probabilities were filled with to begin with
+        sampler.isValid = true;
+    }
+
+    const Entry* sample() const {
+        QRandomGenerator* generator = QRandomGenerator::global();
+        const int column = int(generator->bounded(int(sampler.entries.count())));
+        if (generator->generateDouble() < sampler.probabilities.at(column)) {
+            return sampler.entries.at(column);
+        }
+        return sampler.entries.at(sampler.aliases.at(column));
+    }
+
+    // Tell the entries from the given position onwards which row they are on
+    void renumberEntries(int first) {
+        for (int i = first; i < commands.count(); ++i) {
+            commands[i]->row = i;
+        }
+    }
+
+    // Store the device's view of the command in the entry (adding the device to the entry if needed)
+    void setDeviceState(Entry* entry, GearBase* device, const CommandInfo& command, bool isRunning, bool isAvailable) {
+        if (!entry->devices.contains(device)) {
+            entry->devices << device;
+        }
+        Entry::DeviceState& state = entry->deviceStates[device];
+        const bool available = isAvailable && device->isConnected();
+        entry->runningCount += int(isRunning) - int(state.isRunning);
+        entry->availableCount += int(available) - int(state.isAvailable);
+        state = Entry::DeviceState{command.duration, command.minimumCooldown, isRunning, available};
+    }
+
+    void removeDeviceState(Entry* entry, GearBase* device) {
+        entry->devices.removeAll(device);
+        const auto it = entry->deviceStates.constFind(device);
+        if (it != entry->deviceStates.constEnd()) {
+            entry->runningCount -= int(it.value().isRunning);
+            entry->availableCount -= int(it.value().isAvailable);
+            entry->deviceStates.erase(it);
+        }
+    }
+
+    // Work out the state of the given entry's contained command from what the entry knows about
+    // each of its devices: the duration is whatever is the longest duration for this command in all
+    // the entry's devices, and it is running (or available) if it is so on any of them.
+    // Returns whether anything actually changed
+    bool refreshEntry(Entry *entry) {
+        const CommandInfo old = entry->command;
         entry->command.duration = 0;
         entry->command.minimumCooldown = 0;
         for (GearBase* device : entry->devices) {
-            const CommandInfoList deviceCommands = device->commandModel->allCommands();
-            for (const CommandInfo &existing : deviceCommands) {
-                if (entry->command.equivalent(existing)) {
-                    if (entry->command.duration < existing.duration) {
-                        entry->command.duration = existing.duration;
-                        entry->command.minimumCooldown = existing.minimumCooldown;
-                    }
-                }
+            const Entry::DeviceState state = entry->deviceStates.value(device);
+            if (entry->command.duration < state.duration) {
+                entry->command.duration = state.duration;
+                entry->command.minimumCooldown = state.minimumCooldown;
             }
         }
-        const int index = commands.indexOf(entry);
-        const QModelIndex modelIndex = q->index(index);
-        q->dataChanged(modelIndex, modelIndex, QVector<int>{CommandModel::Duration, CommandModel::MinimumCooldown});
+        entry->command.isRunning = (entry->runningCount > 0);
+        entry->command.isAvailable = (entry->availableCount > 0);
+        return (old.duration != entry->command.duration
+            || old.minimumCooldown != entry->command.minimumCooldown
+            || old.isRunning != entry->command.isRunning
+            || old.isAvailable != entry->command.isAvailable);
+    }
+
+    // Tell everybody that the given entries changed, in one go
+    void reportEntriesChanged(const QSet<Entry*>& changedEntries) {
+        int first{-1};
+        int last{-1};
+        for (const Entry* entry : changedEntries) {
+            first = (first == -1) ? entry->row : qMin(first, entry->row);
+            last = qMax(last, entry->row);
+        }
+        if (first > -1) {
+            static const QVector<int> roles{CommandModel::Duration, CommandModel::MinimumCooldown, CommandModel::IsRunning, CommandModel::IsAvailable};
+            q->dataChanged(q->index(first), q->index(last), roles);
+        }
     }
 
     void addCommand(const CommandInfo& command, GearBase* device) {
-        Entry* entry{nullptr};
         // check if command already exists in some entry
-        for (Entry* existing : commands) {
-            if (existing->command.equivalent(command)) {
-                entry = existing;
-                break;
+        Entry* entry = byEquivalenceKey.value(command.equivalenceKey());
+        if (entry) {
+            setDeviceState(entry, device, command, command.isRunning, command.isAvailable);
+            if (refreshEntry(entry)) {
+                reportEntriesChanged(QSet<Entry*>{entry});
             }
-        }
-        // if not, create a new entry and store the command in it
-        if (!entry) {
+        } else {
+            // if not, create a new entry and store the command in it
             entry = new Entry(command);
+            setDeviceState(entry, device, command, command.isRunning, command.isAvailable);
+            refreshEntry(entry);
             q->beginInsertRows(QModelIndex(), commands.count(), commands.count());
+            entry->row = commands.count();
             commands << entry;
+            indexEntry(entry);
             q->endInsertRows();
         }
-        // add device to entry (shouldn't really be possible for this to happen twice, but...)
-        if (!entry->devices.contains(device)) {
-            entry->devices << device;
-        }
-        updateEntryDurations(entry);
     }
 
     void removeCommand(const CommandInfo& command, GearBase* device) {
-        Entry* entry{nullptr};
         // check if command exists
-        for (Entry* existing : commands) {
-            if (existing->command.equivalent(command)) {
-                entry = existing;
-                break;
-            }
-        }
+        Entry* entry = byEquivalenceKey.value(command.equivalenceKey());
         // if command exists in some entry, remove device from it
         if (entry) {
-            if (entry->devices.contains(device)) {
-                entry->devices.removeAll(device);
-            }
+            removeDeviceState(entry, device);
             // if there are no more devices in that command, remove the entry
             if (entry->devices.count() == 0) {
-                const int position = commands.indexOf(entry);
+                const int position = entry->row;
                 q->beginRemoveRows(QModelIndex(), position, position);
                 commands.remove(position);
+                unindexEntry(entry);
+                renumberEntries(position);
                 q->endRemoveRows();
+                // The device might have had the command more than once, so make sure none of its
+                // other rows are left pointing at the entry
+                auto rows = deviceRows.find(device);
+                if (rows != deviceRows.end()) {
+                    std::replace(rows.value().begin(), rows.value().end(), entry, static_cast<Entry*>(nullptr));
+                }
                 delete entry;
-            } else {
-                updateEntryDurations(entry);
+            } else if (refreshEntry(entry)) {
+                reportEntriesChanged(QSet<Entry*>{entry});
             }
         }
     }
 
-    void addDeviceCommands(GearBase* device) {
-        GearCommandModel* deviceCommands = device->commandModel;
-        for (const CommandInfo& command : deviceCommands->allCommands()) {
-            addCommand(command, device);
+    // Keep the row mapping for the device in step with rows added to its command model
+    void deviceRowsInserted(GearBase* device, int first, int last) {
+        const CommandInfoList& allCommands = device->commandModel->allCommands();
+        QList<Entry*>& rows = deviceRows[device];
+        for (int i = first; i <= last && i < allCommands.count(); ++i) {
+            rows.insert(qMin(i, int(rows.count())), byEquivalenceKey.value(allCommands.at(i).equivalenceKey()));
         }
     }
 
-    void removeDeviceCommands(GearBase* device) {
-        q->beginResetModel();
-        QMutableVectorIterator<Entry*> it(commands);
-        while (it.hasNext()) {
-            it.next();
-            // Remove mention of device if it exists in an entry
-            if (it.value()->devices.contains(device)) {
-                it.value()->devices.removeAll(device);
-                // If entry is now empty of devices, remove and delete it
-                if (it.value()->devices.count() == 0) {
-                    delete it.value();
-                    it.remove();
-                }
-            }
+    void deviceRowsRemoved(GearBase* device, int first, int last) {
+        auto rows = deviceRows.find(device);
+        if (rows != deviceRows.end() && first < rows.value().count()) {
+            rows.value().remove(first, qMin(last, int(rows.value().count()) - 1) - first + 1);
         }
-        q->endResetModel();
     }
 
-    void deviceDataChanged(GearBase* device, const QModelIndex& topLeft, const QModelIndex& bottomRight, const QVector< int >& roles) {
-        GearCommandModel* deviceCommands = device->commandModel;
-        int first = topLeft.row();
-        int last = bottomRight.row();
-        int i = -1;
-        for (const CommandInfo& cmd : deviceCommands->allCommands()) {
-            ++i;
-            if (i < first) { continue; }
-            if (i > last) { break; }
-            Entry* theEntry{nullptr};
-            int entryIdx{-1};
-            for (Entry* entry : commands) {
-                ++entryIdx;
-                if (entry->command.equivalent(cmd) && entry->devices.contains(device)) {
-                    theEntry = entry;
-//                     qDebug() << "Found the entry which has the same command" << theEntry;
-                    break;
-                }
+    // Bring the entries in line with the given list of commands for the device, in a single pass.
+    // Rather than taking the device out of everything and adding it back in (and resetting the
+    // model in the process), this works out what actually changed: entries which lose their last
+    // device are removed (neighbouring ones together), new entries are added together at the end
+    // in one block, and the entries whose state changed are reported in one go.
+    // If deviceCommands is null, the device is taken out of everything
+    void syncDeviceCommands(GearBase* device, const GearCommandModel* deviceCommands) {
+        static const CommandInfoList noCommands;
+        const CommandInfoList& commandList = deviceCommands ? deviceCommands->allCommands() : noCommands;
+        QList<Entry*> newEntries;
+        QSet<Entry*> createdEntries;
+        QSet<Entry*> presentEntries;
+        QSet<Entry*> changedEntries;
+        QList<Entry*> rows;
+        rows.reserve(commandList.count());
+        for (int row = 0; row < commandList.count(); ++row) {
+            const CommandInfo& command = commandList.at(row);
+            Entry* entry = byEquivalenceKey.value(command.equivalenceKey());
+            if (!entry) {
+                entry = new Entry(command);
+                newEntries << entry;
+                createdEntries.insert(entry);
+                indexEntry(entry);
+            }
+            presentEntries.insert(entry);
+            rows << entry;
+            setDeviceState(entry, device, command, deviceCommands->isRunningAt(row), deviceCommands->isAvailableAt(row));
+            if (refreshEntry(entry) && !createdEntries.contains(entry)) {
+                changedEntries.insert(entry);
             }
-            if (theEntry) {
-                QVector<int> theRoles = roles;
-                QVector<int> ourRoles;
-                if (roles.length() == 0) {
-                    // this would want commenting back in when there's things other than IsRunning to worry about,
-                    // such as the future IsAvailable field (for a less obstructive "you can't run this command
-                    // now" method that is less app-blocky)
-                    theRoles = q->roleNames().keys().toVector();
-//                     theRoles << GearCommandModel::IsRunning;
+        }
+        if (rows.isEmpty()) {
+            deviceRows.remove(device);
+        } else {
+            deviceRows.insert(device, rows);
+        }
+
+        // Anything the device was in, which is not in the list, loses the device
+        QList<int> emptiedRows;
+        for (int i = 0; i < commands.count(); ++i) {
+            Entry* entry = commands.at(i);
+            if (!presentEntries.contains(entry) && entry->deviceStates.contains(device)) {
+                removeDeviceState(entry, device);
+                if (entry->devices.isEmpty()) {
+                    emptiedRows << i;
+                } else if (refreshEntry(entry)) {
+                    changedEntries.insert(entry);
                 }
-                for (int role : theRoles) {
-//                     qDebug() << "The role which changed was" << role;
-                    if (role == GearCommandModel::IsRunning) {
-                        // we've got something we care about, let's deal with it
-                        bool anyRunning{false};
-                        for (GearBase* aDevice : theEntry->devices) {
-                            anyRunning = aDevice->commandModel->isRunning(cmd);
-                            if (anyRunning) {
-                                break;
-                            }
-                        }
-                        theEntry->command.isRunning = anyRunning;
-                        ourRoles << CommandModel::IsRunning;
-                    } else if (role == GearCommandModel::IsAvailable) {
-                        // we've got something we care about, let's deal with it
-                        bool anyAvailable{false};
-                        for (GearBase* aDevice : theEntry->devices) {
-                            if (aDevice->isConnected()) {
-                                anyAvailable = aDevice->commandModel->isAvailable(cmd);
-                                if (anyAvailable) {
-                                    break;
-                                }
-                            }
-                        }
-                        theEntry->command.isAvailable = anyAvailable;
-                        ourRoles << CommandModel::IsAvailable;
-                    }
+            }
+        }
+        // Work from the back, so the rows we have yet to remove stay put
+        int current = emptiedRows.count() - 1;
+        while (current > -1) {
+            const int last = emptiedRows.at(current);
+            while (current > 0 && emptiedRows.at(current - 1) == emptiedRows.at(current) - 1) {
+                --current;
+            }
+            const int first = emptiedRows.at(current);
+            q->beginRemoveRows(QModelIndex(), first, last);
+            for (int i = first; i <= last; ++i) {
+                unindexEntry(commands.at(i));
+                delete commands.at(i);
+            }
+            commands.remove(first, last - first + 1);
+            renumberEntries(first);
+            q->endRemoveRows();
+            --current;
+        }
+
+        reportEntriesChanged(changedEntries);
+        if (!newEntries.isEmpty()) {
+            q->beginInsertRows(QModelIndex(), commands.count(), commands.count() + newEntries.count() - 1);
+            commands << newEntries;
+            renumberEntries(commands.count() - newEntries.count());
+            q->endInsertRows();
+        }
+    }
+
+    void addDeviceCommands(GearBase* device) {
+        syncDeviceCommands(device, device->commandModel);
+    }
+
+    void removeDeviceCommands(GearBase* device) {
+        syncDeviceCommands(device, nullptr);
+    }
+
+    // We keep what we need to know about each device's commands ourselves, so whichever roles
+    // changed, we simply pick up the device's current view of the rows in question
+    void deviceDataChanged(GearBase* device, const QModelIndex& topLeft, const QModelIndex& bottomRight) {
+        const CommandInfoList& allCommands = device->commandModel->allCommands();
+        const auto rows = deviceRows.constFind(device);
+        const bool rowsKnown = (rows != deviceRows.constEnd() && rows.value().count() == allCommands.count());
+        QSet<Entry*> changedEntries;
+        for (int i = qMax(0, topLeft.row()); i <= bottomRight.row() && i < allCommands.count(); ++i) {
+            const CommandInfo& cmd = allCommands.at(i);
+            Entry* theEntry = rowsKnown ? rows.value().at(i) : byEquivalenceKey.value(cmd.equivalenceKey());
+            if (theEntry && theEntry->deviceStates.contains(device)) {
+                setDeviceState(theEntry, device, cmd, device->commandModel->isRunningAt(i), device->commandModel->isAvailableAt(i));
+                if (refreshEntry(theEntry)) {
+                    changedEntries.insert(theEntry);
                 }
-                q->dataChanged(q->index(entryIdx), q->index(entryIdx), ourRoles);
             } else {
                 qDebug() << "Something broke, and we got a data changed signal for something with no equivalent Entry..." << device << cmd.command;
             }
         }
+        // The device tells us about a whole group changing in one go, so we pass that on in one go as well
+        reportEntriesChanged(changedEntries);
     }
 
     void registerDevice(GearBase* device) {
         GearCommandModel* deviceCommands = device->commandModel;
         QObject::connect(deviceCommands, &GearCommandModel::commandAdded, q, [this, device](const CommandInfo& command){ addCommand(command, device); });
         QObject::connect(deviceCommands, &GearCommandModel::commandRemoved, q, [this, device](const CommandInfo& command){ removeCommand(command, device); });
-        QObject::connect(deviceCommands, &QAbstractListModel::modelAboutToBeReset, q, [this, device](){ removeDeviceCommands(device); });
-        QObject::connect(deviceCommands, &QAbstractListModel::modelReset, q, [this, device](){ removeDeviceCommands(device); addDeviceCommands(device); });
-        QObject::connect(deviceCommands, &QAbstractItemModel::dataChanged, q, [this, device](const QModelIndex& topLeft, const QModelIndex& bottomRight, const QVector< int >& roles){ deviceDataChanged(device, topLeft, bottomRight, roles); });
+        // We keep our own copies of everything we need, so there is nothing to do until the reset is
+        // done, and then we only pass on whatever actually changed
+        QObject::connect(deviceCommands, &QAbstractListModel::modelReset, q, [this, device](){ addDeviceCommands(device); });
+        QObject::connect(deviceCommands, &QAbstractItemModel::rowsInserted, q, [this, device](const QModelIndex&, int first, int last){ deviceRowsInserted(device, first, last); });
+        QObject::connect(deviceCommands, &QAbstractItemModel::rowsRemoved, q, [this, device](const QModelIndex&, int first, int last){ deviceRowsRemoved(device, first, last); });
+        QObject::connect(deviceCommands, &QAbstractItemModel::dataChanged, q, [this, device](const QModelIndex& topLeft, const QModelIndex& bottomRight){ deviceDataChanged(device, topLeft, bottomRight); });
         QObject::connect(device, &QObject::destroyed, q, [this, device](){ removeDeviceCommands(device); });
         QObject::connect(device, &GearBase::isConnectedChanged, q, [this, device](){
-            removeDeviceCommands(device);
             if (device->isConnected()) {
                 addDeviceCommands(device);
+            } else {
+                removeDeviceCommands(device);
             }
         });
     }
@@ -331,11 +563,11 @@ CommandInfo CommandModel::getCommand(QString command) const
     // preparing for others that are the same, but basically that - these are
     // commands which are technically invalid, but always available)
     cmd.command = command;
-    for(Private::Entry* current : d->commands) {
-        if(current->command.command == command) {
-            cmd = current->command;
-            break;
-        }
+    // Anything which is not in the atom table cannot be one of our commands
+    const CommandAtoms::Atom commandID = CommandAtoms::find(command);
+    const auto it = d->byCommand.constFind(commandID);
+    if (commandID > 0 && it != d->byCommand.constEnd()) {
+        cmd = it.value().first()->command;
     }
     return cmd;
 }
@@ -343,14 +575,22 @@ CommandInfo CommandModel::getCommand(QString command) const
 CommandInfo CommandModel::getRandomCommand(QStringList includedCategories) const
 {
     if(d->commands.count() > 0) {
-        CommandInfoList pickFrom;
-        for(Private::Entry* current : d->commands) {
-            if(includedCategories.isEmpty() || includedCategories.contains(current->command.category)) {
-                pickFrom << current->command;
-            }
+        if (!d->sampler.isValid || d->sampler.categories != includedCategories) {
+            d->buildSampler(includedCategories);
         }
-        if (pickFrom.count() > 0) {
-            return pickFrom.at(QRandomGenerator::global()->bounded(pickFrom.count()));
+        if (d->sampler.entries.count() > 0) {
+            // Try not to repeat any of the most recent picks, as long as there are enough other commands to pick from
+            const int window = qMin(Private::noRepeatWindow, int(d->sampler.entries.count()) - 1);
+            const QList<const Private::Entry*> avoid = d->recentPicks.mid(0, window);
+            const Private::Entry* picked = d->sample();
+            for (int attempt = 1; attempt < Private::noRepeatAttempts && avoid.contains(picked); ++attempt) {
+                picked = d->sample();
+            }
+            d->recentPicks.prepend(picked);
+            if (d->recentPicks.count() > Private::noRepeatWindow) {
+                d->recentPicks.resize(Private::noRepeatWindow);
+            }
+            return picked->command;
         }
         qWarning() << "We have no commands to pick from - maybe we should inform the user of this...";
     }
@@ -75,6 +75,11 @@ public:
      * to commands with the category listed in includedCategories. If the list is
      * empty, any command will be listed.
      *
+     * Commands are picked according to their weight (so a command with a weight of
+     * two is picked twice as often as one with a weight of one, and commands with a
+     * weight of zero are never picked), and the most recent picks are avoided, as long
+     * as there is anything else to pick.
+     *
      * @param includedCategories A list of strings matching the categories
      * @return A random command matching one of the requested categories
      */
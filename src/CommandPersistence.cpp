@@ -21,7 +21,12 @@
 
 #include <QDebug>
 
+#include <QCborArray>
+#include <QCborStreamReader>
+#include <QCborValue>
+#include <QCryptographicHash>
 #include <QDir>
+#include <QSaveFile>
 #include <QStandardPaths>
 
 #include <QJsonArray>
@@ -60,6 +65,121 @@ public:
         }
         return QString::fromUtf8("%1/%2.crumpet").arg(path).arg(filename);
     }
+
+    // Bump this whenever the layout of the compiled documents changes, so the old ones are left alone
+    static constexpr int compiledFormatVersion{1};
+
+    // The compiled version of a document lives in the cache, named after a hash of the json it was
+    // compiled from, so changing a file in any way simply means a different cache entry gets used
+    static QString cachePath() {
+        const QString path = QStandardPaths::writableLocation(QStandardPaths::CacheLocation).append(QLatin1String{"/crumpets"});
+        QDir directory{path};
+        if (!directory.exists() && !directory.mkpath(QLatin1String{"."})) {
+            return QString{};
+        }
+        return path;
+    }
+
+    static QString cacheFileName(const QByteArray& hash) {
+        const QString path = cachePath();
+        if (path.isEmpty()) {
+            return QString{};
+        }
+        return QString::fromUtf8("%1/%2-%3.cbor").arg(path).arg(QString::fromLatin1(hash)).arg(compiledFormatVersion);
+    }
+
+    static bool readCborString(QCborStreamReader& reader, QString& string) {
+        if (!reader.isString()) {
+            return false;
+        }
+        string.clear();
+        auto chunk = reader.readString();
+        while (chunk.status == QCborStreamReader::Ok) {
+            string += chunk.data;
+            chunk = reader.readString();
+        }
+        return chunk.status != QCborStreamReader::Error;
+    }
+
+    // The title and description are the first things in a compiled document, so we can stop
+    // reading as soon as we have them, and leave the commands entirely alone
+    static bool readCompiledHeader(QIODevice* device, QString& title, QString& description) {
+        QCborStreamReader reader(device);
+        if (!reader.isArray() || !reader.enterContainer()) {
+            return false;
+        }
+        if (!reader.isInteger() || reader.toInteger() != compiledFormatVersion) {
+            return false;
+        }
+        reader.next();
+        return readCborString(reader, title) && readCborString(reader, description);
+    }
+
+    // A very small json scanner, which knows just enough to step over values without building
+    // anything out of them. Each of these moves position past the thing it reads, and returns
+    // false if the document ends before it should, or contains something it should not.
+    static void skipWhitespace(const QByteArray& json, qsizetype& position) {
+        while (position < json.size() && (json.at(position) == ' ' || json.at(position) == '\n' || json.at(position) == '\r' || json.at(position) == '\t')) {
+            ++position;
+        }
+    }
+
+    static bool skipString(const QByteArray& json, qsizetype& position) {
+        // Step over the opening quote
+        ++position;
+        while (position < json.size()) {
+            const char character = json.at(position++);
+            if (character == '\\') {
+                ++position;
+            } else if (character == '"') {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool skipValue(const QByteArray& json, qsizetype& position) {
+        if (position >= json.size()) {
+            return false;
+        }
+        const char first = json.at(position);
+        if (first == '"') {
+            return skipString(json, position);
+        }
+        if (first == '{' || first == '[') {
+            int depth{0};
+            while (position < json.size()) {
+                const char character = json.at(position);
+                if (character == '"') {
+                    if (!skipString(json, position)) {
+                        return false;
+                    }
+                    continue;
+                }
+                ++position;
+                if (character == '{' || character == '[') {
+                    ++depth;
+                } else if ((character == '}' || character == ']') && --depth == 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        // Numbers, true, false, and null all simply run until the next separator
+        static const QByteArray separators{",}] \n\r\t"};
+        const qsizetype start{position};
+        while (position < json.size() && !separators.contains(json.at(position))) {
+            ++position;
+        }
+        return position > start;
+    }
+
+    static QString decodeString(const QByteArray& value) {
+        // Strings can contain all manner of escapes, so let the real parser deal with the
+        // (tiny) array holding just this one value
+        const QJsonDocument doc = QJsonDocument::fromJson(QByteArray{"["}.append(value).append(']'));
+        return doc.array().at(0).toString();
+    }
 };
 
 CommandPersistence::CommandPersistence(QObject* parent)
@@ -91,10 +211,13 @@ bool CommandPersistence::deserialize(const QString& json)
                 CommandInfo info;
                 info.name = commandObject.value(QLatin1String{"Name"}).toString();
                 info.command = commandObject.value(QLatin1String{"Command"}).toString();
+                info.internCommand();
                 info.category = commandObject.value(QLatin1String{"Category"}).toString();
                 info.duration = commandObject.value(QLatin1String{"Duration"}).toInt(); // milliseconds
                 info.minimumCooldown = commandObject.value(QLatin1String{"MinimumCooldown"}).toInt(); // milliseconds
                 info.group = commandObject.value(QLatin1String{"Group"}).toInt();
+                // Weight is optional, and most commands will not bother setting it
+                info.weight = qMax(0, commandObject.value(QLatin1String{"Weight"}).toInt(1));
                 commandsList.append(info);
 //                 qDebug() << "Added the command" << info.name << "with command" << info.command;
             }
@@ -125,6 +248,196 @@ bool CommandPersistence::deserialize(const QString& json)
     return keepgoing;
 }
 
+bool CommandPersistence::deserializeCached(const QString& json)
+{
+    return deserializeCached(json, documentHash(json));
+}
+
+bool CommandPersistence::deserializeCached(const QString& json, const QByteArray& hash)
+{
+    const QString cacheFile = Private::cacheFileName(hash);
+    if (!cacheFile.isEmpty()) {
+        QFile file(cacheFile);
+        if (file.open(QIODevice::ReadOnly) && loadCompiled(file.readAll())) {
+            return true;
+        }
+    }
+    const bool result = deserialize(json);
+    // Only things which loaded without any complaints get cached, so the complaints still
+    // get made the next time around
+    if (result && d->error.isEmpty() && !cacheFile.isEmpty()) {
+        QSaveFile file(cacheFile);
+        if (file.open(QIODevice::WriteOnly)) {
+            file.write(compiled());
+            file.commit();
+        }
+    }
+    return result;
+}
+
+bool CommandPersistence::readHeader(const QString& json)
+{
+    return readHeader(json, documentHash(json));
+}
+
+bool CommandPersistence::readHeader(const QString& json, const QByteArray& hash)
+{
+    QString title;
+    QString description;
+    const QString cacheFile = Private::cacheFileName(hash);
+    if (!cacheFile.isEmpty()) {
+        QFile file(cacheFile);
+        // Only documents which loaded without complaint end up in the cache, so finding
+        // it there means we already know it is good
+        if (file.open(QIODevice::ReadOnly) && Private::readCompiledHeader(&file, title, description)) {
+            setTitle(title);
+            setDescription(description);
+            return true;
+        }
+    }
+
+    const QByteArray data = json.toUtf8();
+    static const QByteArray titleKey{"\"Title\""};
+    static const QByteArray descriptionKey{"\"Description\""};
+    static const QByteArray commandsKey{"\"Commands\""};
+    bool hasCommands{false};
+    qsizetype position{0};
+    Private::skipWhitespace(data, position);
+    if (position >= data.size() || data.at(position) != '{') {
+        return false;
+    }
+    ++position;
+    while (true) {
+        Private::skipWhitespace(data, position);
+        if (position < data.size() && data.at(position) == '}') {
+            break;
+        }
+        if (position >= data.size() || data.at(position) != '"') {
+            return false;
+        }
+        const qsizetype keyStart{position};
+        if (!Private::skipString(data, position)) {
+            return false;
+        }
+        const QByteArray key = data.mid(keyStart, position - keyStart);
+        Private::skipWhitespace(data, position);
+        if (position >= data.size() || data.at(position) != ':') {
+            return false;
+        }
+        ++position;
+        Private::skipWhitespace(data, position);
+        const qsizetype valueStart{position};
+        if (!Private::skipValue(data, position)) {
+            return false;
+        }
+        const QByteArray value = data.mid(valueStart, position - valueStart);
+        if (key == titleKey) {
+            title = Private::decodeString(value);
+        } else if (key == descriptionKey) {
+            description = Private::decodeString(value);
+        } else if (key == commandsKey) {
+            // An array with anything at all between its brackets
+            hasCommands = value.startsWith('[') && !value.mid(1, value.size() - 2).trimmed().isEmpty();
+        }
+        Private::skipWhitespace(data, position);
+        if (position < data.size() && data.at(position) == ',') {
+            ++position;
+        } else if (position >= data.size() || data.at(position) != '}') {
+            return false;
+        }
+    }
+    setTitle(title);
+    setDescription(description);
+    return hasCommands;
+}
+
+QByteArray CommandPersistence::documentHash(const QString& json)
+{
+    return QCryptographicHash::hash(json.toUtf8(), QCryptographicHash::Sha1).toHex();
+}
+
+void CommandPersistence::evictCached(const QByteArray& hash)
+{
+    const QString cacheFile = Private::cacheFileName(hash);
+    if (!cacheFile.isEmpty()) {
+        QFile::remove(cacheFile);
+    }
+}
+
+void CommandPersistence::pruneCache(const QSet<QByteArray>& hashes)
+{
+    const QString path = Private::cachePath();
+    if (path.isEmpty()) {
+        return;
+    }
+    QDir directory{path};
+    const QString suffix = QString::fromUtf8("-%1.cbor").arg(Private::compiledFormatVersion);
+    const QStringList entries = directory.entryList(QDir::Files);
+    for (const QString& entry : entries) {
+        // Anything compiled by an older version, or from a document nobody has any more, goes
+        if (!entry.endsWith(suffix) || !hashes.contains(entry.chopped(suffix.length()).toLatin1())) {
+            directory.remove(entry);
+        }
+    }
+}
+
+QByteArray CommandPersistence::compiled() const
+{
+    // Everything is stored positionally, in the order the fields are listed here
+    QCborArray commands;
+    for (const CommandInfo& command : std::as_const(d->commands)) {
+        commands.append(QCborArray{command.name, command.command, command.category, command.duration, command.minimumCooldown, command.group, command.weight});
+    }
+    QCborArray shorthands;
+    for (const CommandShorthand& shorthand : std::as_const(d->shorthands)) {
+        shorthands.append(QCborArray{shorthand.command, QCborArray::fromStringList(shorthand.expansion)});
+    }
+    const QCborArray document{Private::compiledFormatVersion, d->title, d->description, commands, shorthands};
+    return QCborValue(document).toCbor();
+}
+
+bool CommandPersistence::loadCompiled(const QByteArray& data)
+{
+    QCborParserError parseError;
+    const QCborArray document = QCborValue::fromCbor(data, &parseError).toArray();
+    if (parseError.error != QCborError::NoError || document.size() != 5 || document.at(0).toInteger() != Private::compiledFormatVersion) {
+        return false;
+    }
+    const QCborArray commands = document.at(3).toArray();
+    CommandInfoList commandsList;
+    commandsList.reserve(commands.size());
+    for (qsizetype i = 0; i < commands.size(); ++i) {
+        const QCborArray fields = commands.at(i).toArray();
+        CommandInfo info;
+        info.name = fields.at(0).toString();
+        info.command = fields.at(1).toString();
+        info.internCommand();
+        info.category = fields.at(2).toString();
+        info.duration = int(fields.at(3).toInteger());
+        info.minimumCooldown = int(fields.at(4).toInteger());
+        info.group = int(fields.at(5).toInteger());
+        info.weight = int(fields.at(6).toInteger(1));
+        commandsList.append(info);
+    }
+    const QCborArray shorthands = document.at(4).toArray();
+    CommandShorthandList shorthandList;
+    for (qsizetype i = 0; i < shorthands.size(); ++i) {
+        const QCborArray fields = shorthands.at(i).toArray();
+        const QCborArray expansion = fields.at(1).toArray();
+        CommandShorthand shorthand;
+        shorthand.command = fields.at(0).toString();
+        for (qsizetype j = 0; j < expansion.size(); ++j) {
+            shorthand.expansion << expansion.at(j).toString();
+        }
+        shorthandList.append(shorthand);
+    }
+    setTitle(document.at(1).toString());
+    setDescription(document.at(2).toString());
+    setCommands(commandsList);
+    setShorthands(shorthandList);
+    return true;
+}
+
 QString CommandPersistence::serialized() const
 {
     QJsonArray commands;
@@ -136,6 +449,9 @@ QString CommandPersistence::serialized() const
         commandObject[QLatin1String{"Duration"}] = command.duration;
         commandObject[QLatin1String{"MinimumCooldown"}] = command.minimumCooldown;
         commandObject[QLatin1String{"Group"}] = command.group;
+        if (command.weight != 1) {
+            commandObject[QLatin1String{"Weight"}] = command.weight;
+        }
         commands.append(commandObject);
     }
     QJsonArray shorthands;
@@ -19,6 +19,7 @@
 #define COMMANDPERSISTENCE_H
 
 #include <QObject>
+#include <QSet>
 #include <QUrl>
 
 #include "CommandInfo.h"
@@ -90,6 +91,81 @@ public:
      * @see read()
      */
     bool deserialize(const QString& json);
+    /**
+     * Does the same as deserialize(), but skips parsing the json if a compiled
+     * version of the exact same document is already in the cache. If it is not,
+     * the json is parsed as usual, and if that works, the compiled version is
+     * stored in the cache for next time.
+     *
+     * @param json A string which should contain a fully formed json document
+     * @return Whether or not the deserialisation was successful
+     * @see compiled()
+     */
+    bool deserializeCached(const QString& json);
+    /**
+     * Does the same as deserializeCached(const QString&), for when the hash of the
+     * document is already known, so it does not need working out again
+     *
+     * @param json A string which should contain a fully formed json document
+     * @param hash The hash of the document (see documentHash())
+     * @return Whether or not the deserialisation was successful
+     */
+    bool deserializeCached(const QString& json, const QByteArray& hash);
+    /**
+     * Set only the title and description from a document, without loading any of
+     * its commands or shorthands. This uses the compiled version of the document
+     * if there is one in the cache, and otherwise skims through the json for the
+     * two fields without building anything out of the rest of it.
+     *
+     * @note As the commands are not looked at in any detail, a document which
+     * passes this check might still fail to deserialize fully.
+     *
+     * @param json A string which should contain a fully formed json document
+     * @return Whether the document looks like a command file with commands in it
+     * @see deserializeCached(const QString&)
+     */
+    bool readHeader(const QString& json);
+    /**
+     * Does the same as readHeader(const QString&), for when the hash of the
+     * document is already known, so it does not need working out again
+     *
+     * @param json A string which should contain a fully formed json document
+     * @param hash The hash of the document (see documentHash())
+     * @return Whether the document looks like a command file with commands in it
+     */
+    bool readHeader(const QString& json, const QByteArray& hash);
+    /**
+     * The hash a document's compiled version is stored in the cache under
+     * @param json The document
+     * @return The hash of the document, as hex
+     */
+    static QByteArray documentHash(const QString& json);
+    /**
+     * Remove the compiled version of a document from the cache, for when nobody
+     * is using that document any more (for example, because it was changed)
+     * @param hash The hash of the document (see documentHash())
+     */
+    static void evictCached(const QByteArray& hash);
+    /**
+     * Remove everything from the cache except the compiled versions of the given
+     * documents, along with anything compiled by a different version of the format
+     * @param hashes The hashes of all the documents still in use (see documentHash())
+     */
+    static void pruneCache(const QSet<QByteArray>& hashes);
+    /**
+     * Get a compact binary (CBOR) version of what is currently stored in this
+     * class, which is much quicker to load than the json version.
+     * @return The compiled document
+     * @see loadCompiled(const QByteArray&)
+     */
+    QByteArray compiled() const;
+    /**
+     * Set the title, description, commands, and shorthands from a document
+     * previously created by compiled()
+     * @param data The compiled document
+     * @return Whether the data was a compiled document this version understands
+     */
+    bool loadCompiled(const QByteArray& data);
     /**
      * Get the json serialised version of what is currently stored in this class.
      * This is also what will be stored in the file when you write it.
@@ -16,11 +16,18 @@
  */
 
 #include "CommandQueue.h"
+#include "AppSettings.h"
 #include "BTConnectionManager.h"
 #include "CommandModel.h"
+#include "DeadlineScheduler.h"
 #include "DeviceModel.h"
+#include "GearBase.h"
 
-#include <QTimer>
+#include <QDateTime>
+#include <QSet>
+
+#include <algorithm>
+#include <limits>
 
 class CommandQueue::Private
 {
@@ -29,70 +36,654 @@ public:
         : q(qq)
         , connectionManager(connectionManager)
     {
-        currentCommandTimer = new QTimer(qq);
-        currentCommandTimer->setSingleShot(true);
-        currentCommandTimerChecker = new QTimer(qq);
-        currentCommandTimerChecker->setInterval(100);
-        q->connect(currentCommandTimer, &QTimer::timeout, [this](){
-            currentCommandTimerChecker->stop();
-            Q_EMIT q->currentCommandRemainingMSecondsChanged(0);
-        });
+        model = new CommandQueueModel(qq);
+    }
+    ~Private()
+    {
+        for (const Lane* theLane : std::as_const(lanes)) {
+            DeadlineScheduler::getInstance()->cancel(theLane->handle);
+        }
+        qDeleteAll(lanes);
     }
-    ~Private() {}
 
     CommandQueue* q{nullptr};
 
-    struct Entry {
-        Entry(const CommandInfo& command)
-            : command(command)
-        {}
-        ~Entry() { }
-        CommandInfo command;
-        QStringList deviceIDs;
+    typedef CommandQueueModel::Entry Entry;
+    CommandQueueModel* model{nullptr};
+
+    /**
+     * A lane holds the entries destined for one device, in queue order. Lanes
+     * advance independently of each other, so a command for one piece of gear
+     * does not have to wait for a command on another to finish. An entry which
+     * targets several devices waits until it is at the front of all its lanes,
+     * so those devices still start it together.
+     */
+    struct Lane {
+        // The sequence numbers of the entries in this lane
+        QList<quint64> pending;
+        // Scheduled for as long as the lane is busy running an entry (including cooldown),
+        // and zero when the lane is free
+        DeadlineScheduler::Handle handle{0};
+        // When the lane is planned to become free again
+        QDeadlineTimer busyUntil;
+        // When the lane was planned to become free (so, not when it actually did)
+        QDeadlineTimer freeAt;
+        // When the lane is expected to be free again, in milliseconds since the epoch (worked
+        // out once when the lane is occupied, so the plan does not shift about between clocks)
+        qint64 freeAtEpoch{0};
+        // The command the lane is currently busy running (or zero for a pause)
+        CommandAtoms::Atom running{0};
+        // When following the gear's timing, this is the command we are waiting for the
+        // device to report as ended, and the cooldown to wait for once it has
+        CommandAtoms::Atom awaitingEnd{0};
+        int cooldown{0};
+        // Set when the entry at the front of the lane is ready to go, but its device is still
+        // busy running another command in the same group, so it waits for that to end
+        bool waitingForGroup{false};
+        // Set once the entry at the front of the lane has had to wait for its group, as the time
+        // it was planned to start at has then passed while waiting, and it should be planned from
+        // when it actually starts instead
+        bool heldForGroup{false};
     };
-    QVector<Entry*> commands;
+    QHash<QString, Lane*> lanes;
+    // Entries which target all devices also go in this lane, so they still wait
+    // for anything queued up while no devices were connected
+    const QString generalLane;
     BTConnectionManager* connectionManager{nullptr};
 
-    QTimer* popTimer{nullptr};
-    QTimer* currentCommandTimer{nullptr};
-    QTimer* currentCommandTimerChecker{nullptr};
+    QDeadlineTimer currentCommandEnd;
+    int currentCommandDuration{0};
+    // The same as the above, but in wall clock time for the replicas
+    qint64 currentCommandStarted{0};
+    qint64 currentCommandDeadline{0};
+    // How many entries were dropped because none of their devices could run them
+    int skippedCount{0};
+    qint64 queueEmptyAt{0};
+    // What has changed since the plan was last worked out: the lanes whose entries might now
+    // start at a different time, and the sequence numbers of the entries which were added and
+    // have not been planned at all yet. When the order of the entries in the lanes has changed,
+    // everything is planned again.
+    QSet<QString> changedLanes;
+    quint64 unplannedFrom{std::numeric_limits<quint64>::max()};
+    quint64 unplannedUntil{0};
+    bool replanEverything{false};
+
+    // When following the gear's timing, the lane timer is only a fallback in case we
+    // never hear back from the device, so give the device a little leeway (the
+    // conceptual human moment) before we give up on it and move on anyway
+    static constexpr int followGearGracePeriod{3000};
+
+    Lane* lane(const QString& laneID)
+    {
+        Lane* theLane = lanes.value(laneID);
+        if (!theLane) {
+            theLane = new Lane;
+            lanes[laneID] = theLane;
+        }
+        return theLane;
+    }
+
+    // The given deadline in milliseconds since the epoch (which may be in the past)
+    static qint64 toEpoch(const QDeadlineTimer& deadline)
+    {
+        return QDateTime::currentMSecsSinceEpoch() + (deadline.deadlineNSecs() - QDeadlineTimer::current(Qt::PreciseTimer).deadlineNSecs()) / 1000000;
+    }
+
+    // Note that the entries in the lane might start at a different time than planned
+    void planChanged(const QString& laneID)
+    {
+        changedLanes.insert(laneID);
+    }
+
+    // Mark the lane as busy until the given deadline, replacing whatever it was busy with before.
+    // This is what keeps the queue on the beat, so it gets woken up as close to the deadline as possible.
+    void occupy(const QString& laneID, Lane* theLane, const QDeadlineTimer& deadline)
+    {
+        DeadlineScheduler* scheduler = DeadlineScheduler::getInstance();
+        scheduler->cancel(theLane->handle);
+        theLane->busyUntil = deadline;
+        // We expect the device to finish on time, the grace period is just a fallback
+        theLane->freeAtEpoch = toEpoch(theLane->awaitingEnd != 0 ? deadline - followGearGracePeriod : deadline);
+        planChanged(laneID);
+        theLane->handle = scheduler->scheduleAt(deadline, q, [this, laneID](){
+            Lane* theLane = lanes.value(laneID);
+            theLane->handle = 0;
+            theLane->freeAt = theLane->busyUntil;
+            planChanged(laneID);
+            advanceLanes({laneID});
+        }, Qt::PreciseTimer);
+    }
+
+    // Stop the lane being busy, without moving on to the next entry
+    void release(Lane* theLane)
+    {
+        DeadlineScheduler::getInstance()->cancel(theLane->handle);
+        theLane->handle = 0;
+        theLane->freeAt = QDeadlineTimer();
+        theLane->awaitingEnd = 0;
+        theLane->heldForGroup = false;
+    }
+
+    // An empty list of devices means all of them, so for those we occupy the lanes
+    // of every connected device (and the general lane)
+    QStringList resolveLanes(const QStringList& deviceIDs) const
+    {
+        if (deviceIDs.count() > 0) {
+            return deviceIDs;
+        }
+        QStringList resolved{generalLane};
+        DeviceModel* deviceModel = qobject_cast<DeviceModel*>(connectionManager->deviceModel());
+        for (int i = 0; i < deviceModel->count(); ++i) {
+            GearBase* device = deviceModel->getDeviceById(i);
+            if (device->isConnected()) {
+                resolved << device->deviceID();
+            }
+        }
+        return resolved;
+    }
+
+    // The devices an entry for the given devices will be sent to (with an empty list meaning
+    // all the connected devices, just like for the lanes)
+    QList<GearBase*> targetDevices(const QStringList& deviceIDs) const
+    {
+        QList<GearBase*> devices;
+        DeviceModel* deviceModel = qobject_cast<DeviceModel*>(connectionManager->deviceModel());
+        if (deviceIDs.count() > 0) {
+            for (const QString& deviceID : deviceIDs) {
+                GearBase* device = deviceModel->getDevice(deviceID);
+                if (device) {
+                    devices << device;
+                }
+            }
+        } else {
+            for (int i = 0; i < deviceModel->count(); ++i) {
+                GearBase* device = deviceModel->getDeviceById(i);
+                if (device->isConnected()) {
+                    devices << device;
+                }
+            }
+        }
+        return devices;
+    }
+
+    // Add the commands to the queue in one go (after everything of the same or higher priority),
+    // and then start whatever can be started. If asked to preempt, whatever the lanes are
+    // currently busy with is cut short, so the new commands can start right away.
+    void push(const CommandInfoList& commands, const QStringList& deviceIDs, int priority = NormalPriority, bool preempt = false)
+    {
+        if (commands.isEmpty()) {
+            return;
+        }
+        const QStringList entryLanes = resolveLanes(deviceIDs);
+        const QList<GearBase*> devices = targetDevices(deviceIDs);
+        const QDeadlineTimer now = DeadlineScheduler::deadlineIn(0);
+        QList<Entry> entries;
+        entries.reserve(commands.count());
+        for (const CommandInfo& command : commands) {
+            Entry entry;
+            entry.command = command;
+            entry.deviceIDs = deviceIDs;
+            entry.lanes = entryLanes;
+            entry.pushedAt = now;
+            entry.duration = command.duration + command.minimumCooldown;
+            entry.cooldown = command.minimumCooldown;
+            // Work out what to send to each device now, so running the entry is just a matter
+            // of writing it out. Pauses have nothing to send.
+            if (!command.command.isEmpty()) {
+                entry.programs.reserve(devices.count());
+                for (GearBase* device : devices) {
+                    entry.programs << device->compileMessage(command.command);
+                }
+                // The duration of a command differs between devices, and the command model only
+                // knows the longest of them all, so find the longest for the devices we send to
+                int longest{-1};
+                for (GearBase* device : devices) {
+                    const int row = device->commandModel->indexOfEquivalent(command);
+                    if (row > -1) {
+                        const CommandInfo& deviceCommand = device->commandModel->allCommands().at(row);
+                        if (deviceCommand.duration + deviceCommand.minimumCooldown > longest) {
+                            longest = deviceCommand.duration + deviceCommand.minimumCooldown;
+                            entry.cooldown = deviceCommand.minimumCooldown;
+                        }
+                    }
+                }
+                if (longest > -1) {
+                    entry.duration = longest;
+                }
+            }
+            entries << entry;
+        }
+        const quint64 firstSequence = model->insert(entries, priority);
+        unplannedFrom = qMin(unplannedFrom, firstSequence);
+        unplannedUntil = qMax(unplannedUntil, firstSequence + entries.count() - 1);
+        for (const QString& laneID : entryLanes) {
+            Lane* theLane = lane(laneID);
+            // Lanes are kept in queue order as well, so find the same spot in the lane
+            const int first = int(std::lower_bound(theLane->pending.cbegin(), theLane->pending.cend(), firstSequence) - theLane->pending.cbegin());
+            theLane->pending.insert(first, entries.count(), 0);
+            for (int i = 0; i < entries.count(); ++i) {
+                theLane->pending[first + i] = firstSequence + i;
+            }
+            if (preempt) {
+                // Whatever the lane was running is being cut short, so it should no longer count
+                // as running on the device (or it would hold up the new commands in its group),
+                // and whatever is left of it should not be sent after the new commands either
+                const CommandAtoms::Atom replaced = theLane->handle != 0 ? theLane->running : 0;
+                release(theLane);
+                planChanged(laneID);
+                GearBase* device = qobject_cast<DeviceModel*>(connectionManager->deviceModel())->getDevice(laneID);
+                if (device) {
+                    device->cancelCalls();
+                    if (replaced != 0) {
+                        device->commandModel->setRunning(replaced, false);
+                    }
+                }
+            }
+        }
+        Q_EMIT q->countChanged(q->count());
+
+        // If we have just pushed some commands and their lanes are not currently
+        // busy, let's fire one off now!
+        advanceLanes(entryLanes);
+    }
+
+    // Drop everything queued up in the given lane, using the lane's own list of entries
+    // rather than going through the entire queue. Entries which were also meant for other
+    // devices just stop going to this one, and the rest are removed from the queue.
+    void clearLane(const QString& laneID)
+    {
+        Lane* theLane = lanes.value(laneID);
+        release(theLane);
+        QList<int> removed;
+        QStringList affectedLanes;
+        for (const quint64 sequence : std::as_const(theLane->pending)) {
+            const int index = model->indexOf(sequence);
+            if (index < 0) {
+                continue;
+            }
+            const Entry& entry = model->at(index);
+            QStringList entryLanes = entry.lanes;
+            entryLanes.removeAll(laneID);
+            QStringList deviceIDs = entry.deviceIDs;
+            // An entry without any devices is for all of them, so that just stays as it is
+            if (deviceIDs.count() > 0) {
+                deviceIDs.removeAll(laneID);
+                if (deviceIDs.isEmpty()) {
+                    removed << index;
+                    for (const QString& otherLane : std::as_const(entryLanes)) {
+                        lanes.value(otherLane)->pending.removeOne(sequence);
+                    }
+                }
+            }
+            if (deviceIDs.count() > 0 || entry.deviceIDs.isEmpty()) {
+                QList<GearBase::Program> programs;
+                for (const GearBase::Program& program : entry.programs) {
+                    if (program.device && program.device->deviceID() != laneID) {
+                        programs << program;
+                    }
+                }
+                model->setTargets(index, deviceIDs, entryLanes, programs);
+            }
+            for (const QString& otherLane : std::as_const(entryLanes)) {
+                if (!affectedLanes.contains(otherLane)) {
+                    affectedLanes << otherLane;
+                }
+            }
+        }
+        theLane->pending.clear();
+        // The lane's entries are in queue order, so this is already sorted
+        model->removeEntries(removed);
+        // Some of the remaining entries no longer go to this lane at all
+        replanEverything = true;
+        // Anything which was waiting for this lane might be able to run now
+        advanceLanes(affectedLanes);
+    }
+
+    // Rebuild the pending list for the given lane from the queue's order
+    void rebuildLane(const QString& laneID)
+    {
+        Lane* theLane = lane(laneID);
+        theLane->pending.clear();
+        for (int i = 0; i < model->count(); ++i) {
+            const Entry& entry = model->at(i);
+            if (entry.lanes.contains(laneID)) {
+                theLane->pending.append(entry.sequence);
+            }
+        }
+    }
 
-    void pop()
+    // An entry can start once it is first in line on all its lanes, and none of them are busy
+    bool isStartable(const Entry& entry) const
     {
-        // only pop if there's commands left
-        if(commands.count() > 0) {
-            Entry* entry = commands.takeFirst();
+        for (const QString& laneID : entry.lanes) {
+            const Lane* theLane = lanes.value(laneID);
+            if (!theLane || theLane->handle != 0 || theLane->pending.isEmpty() || theLane->pending.first() != entry.sequence) {
+                return false;
+            }
+        }
+        return true;
+    }
 
-            // Command can be empty if it's a pause (possibly others as well,
-            // though not yet, but just never send an empty command)
-            if(!entry->command.command.isEmpty()) {
-                connectionManager->sendMessage(entry->command.command, entry->deviceIDs);
-                currentCommandTimer->setInterval(entry->command.duration + entry->command.minimumCooldown);
-                currentCommandTimer->start();
-                currentCommandTimerChecker->start();
-                Q_EMIT q->currentCommandTotalDurationChanged(currentCommandTimer->interval());
-                Q_EMIT q->currentCommandRemainingMSecondsChanged(currentCommandTimer->remainingTime());
+    // Whether the lane should wait for the device to tell us it has finished the entry
+    bool followsGear(const QString& laneID, const Entry& entry) const
+    {
+        if (entry.command.command.isEmpty() || !connectionManager->appSettings()->queueFollowsGear()) {
+            return false;
+        }
+        DeviceModel* deviceModel = qobject_cast<DeviceModel*>(connectionManager->deviceModel());
+        GearBase* device = deviceModel->getDevice(laneID);
+        // Commands which are always available might not be in the model at all, and then
+        // there is nothing in it to tell us when they end
+        return device && device->isConnected() && device->commandModel->indexOfEquivalent(entry.command) > -1
+            && device->commandModel->isAvailable(entry.command);
+    }
+
+    // Whether the program can be run by its device at all (that is, the device is there,
+    // and knows the command, or it is one which is always available), regardless of whether
+    // it is busy with something else
+    static bool isReachable(const GearBase::Program& program, const CommandInfo& command)
+    {
+        return program.device && program.device->isConnected()
+            && (GearCommandModel::isAlwaysAvailable(command) || program.device->commandModel->indexOfEquivalent(command) > -1);
+    }
+
+    // Whether any of the devices the entry goes to are still running another command in the
+    // same group, in which case the entry waits for that to end, rather than being dropped
+    static bool isWaitingForGroup(const Entry& entry)
+    {
+        if (!entry.command.command.isEmpty()) {
+            for (const GearBase::Program& program : entry.programs) {
+                if (isReachable(program, entry.command) && !program.device->commandModel->isAvailable(entry.command)) {
+                    return true;
+                }
             }
+        }
+        return false;
+    }
 
-            popTimer->start(entry->command.duration + entry->command.minimumCooldown);
+    // Start the entry at the given position, or if it is a command none of its devices
+    // are able to run at all, drop it without spending any time on it.
+    // Returns false if the entry was skipped.
+    bool start(int index)
+    {
+        const Entry entry = model->take(index);
+        QList<GearBase::Program> programs;
+        if (!entry.command.command.isEmpty()) {
+            for (const GearBase::Program& program : entry.programs) {
+                if (isReachable(program, entry.command)) {
+                    programs << program;
+                }
+            }
+            if (programs.isEmpty()) {
+                qDebug() << "Skipping" << entry.command.command << "in the queue, as none of its devices are connected and know it";
+                for (const QString& laneID : entry.lanes) {
+                    lanes.value(laneID)->pending.removeFirst();
+                    planChanged(laneID);
+                }
+                ++skippedCount;
+                Q_EMIT q->skippedCountChanged(skippedCount);
+                Q_EMIT q->countChanged(q->count());
+                return false;
+            }
+        }
+        const int duration = entry.duration;
+        // Work out when the entry was supposed to start (the latest of when it was pushed, and
+        // when its lanes were planned to become free), and step on from that rather than from
+        // right now. That way a little lateness in waking up does not add up over a long list.
+        // An entry which had to wait for its group did not start when planned, though, so that
+        // one starts from now, or its lanes would be free again before its cooldown has passed.
+        QDeadlineTimer plannedStart = entry.pushedAt;
+        for (const QString& laneID : entry.lanes) {
+            const Lane* theLane = lanes.value(laneID);
+            if (theLane->heldForGroup) {
+                plannedStart = DeadlineScheduler::deadlineIn(0);
+                break;
+            }
+            plannedStart = qMax(plannedStart, theLane->freeAt);
+        }
+        QDeadlineTimer plannedEnd = plannedStart + duration;
+        if (plannedEnd.hasExpired()) {
+            // If we are so far behind that the entry should already be done (say, the device
+            // was asleep), start over from now rather than rushing through everything queued up
+            plannedEnd = DeadlineScheduler::deadlineIn(duration);
+        }
+        for (const QString& laneID : entry.lanes) {
+            Lane* theLane = lanes.value(laneID);
+            theLane->pending.removeFirst();
+            theLane->heldForGroup = false;
+            theLane->running = entry.command.command.isEmpty() ? 0 : entry.command.id();
+            if (followsGear(laneID, entry)) {
+                theLane->awaitingEnd = entry.command.id();
+                theLane->cooldown = entry.cooldown;
+                occupy(laneID, theLane, plannedEnd + followGearGracePeriod);
+            } else {
+                theLane->awaitingEnd = 0;
+                occupy(laneID, theLane, plannedEnd);
+            }
+        }
+
+        // Command can be empty if it's a pause (possibly others as well,
+        // though not yet, but just never send an empty command)
+        if(!entry.command.command.isEmpty()) {
+            for (const GearBase::Program& program : std::as_const(programs)) {
+                program.device->sendProgram(program);
+            }
+            currentCommandEnd = plannedEnd;
+            currentCommandDuration = duration;
+            currentCommandDeadline = toEpoch(plannedEnd);
+            currentCommandStarted = currentCommandDeadline - duration;
+            Q_EMIT q->currentCommandTotalDurationChanged(currentCommandDuration);
+            Q_EMIT q->currentCommandStartedChanged(currentCommandStarted);
+            Q_EMIT q->currentCommandDeadlineChanged(currentCommandDeadline);
+        }
+
+        Q_EMIT q->countChanged(q->count());
+        return true;
+    }
+
+    // The device reported that it ended a command, so if that is what the lane is
+    // waiting for, we only need to wait for the cooldown before moving on. If the end was
+    // not actually reported by the device, but by the command model giving up on it after
+    // its duration and cooldown, or it arrives after the lane was planned to be free anyway,
+    // the cooldown has already passed, and the lane can move on right away.
+    void gearCommandEnded(const QString& laneID, CommandAtoms::Atom command, bool cooldownPassed)
+    {
+        Lane* theLane = lanes.value(laneID);
+        if (theLane && theLane->handle != 0 && theLane->awaitingEnd != 0 && theLane->awaitingEnd == command) {
+            theLane->awaitingEnd = 0;
+            if (cooldownPassed || (theLane->busyUntil - followGearGracePeriod).hasExpired()) {
+                DeadlineScheduler::getInstance()->cancel(theLane->handle);
+                theLane->handle = 0;
+                theLane->freeAt = DeadlineScheduler::deadlineIn(0);
+                planChanged(laneID);
+                advanceLanes({laneID});
+            } else {
+                occupy(laneID, theLane, DeadlineScheduler::deadlineIn(theLane->cooldown));
+                updatePlan();
+            }
+        }
+    }
 
-            Q_EMIT q->countChanged(q->count());
-            delete entry;
+    // If the device's lane is waiting for a command in the same group to end, see whether it can go now
+    void wakeLane(const QString& laneID)
+    {
+        Lane* theLane = lanes.value(laneID);
+        if (theLane && theLane->waitingForGroup) {
+            theLane->waitingForGroup = false;
+            advanceLanes({laneID});
         }
     }
+
+    void registerDevice(GearBase* device)
+    {
+        QObject::connect(device->commandModel, &GearCommandModel::commandRunningChanged, q, [this, device](CommandAtoms::Atom command, bool isRunning, bool endedAutomatically){
+            if (!isRunning) {
+                gearCommandEnded(device->deviceID(), command, endedAutomatically);
+                wakeLane(device->deviceID());
+            }
+        });
+        // Reloading the commands resets their running states without telling us about each one
+        // that stopped, and removing a command might remove the one the lane was waiting for
+        QObject::connect(device->commandModel, &QAbstractItemModel::modelReset, q, [this, device](){
+            wakeLane(device->deviceID());
+        });
+        QObject::connect(device->commandModel, &QAbstractItemModel::rowsRemoved, q, [this, device](){
+            wakeLane(device->deviceID());
+        });
+        // A device going away means whatever was waiting for it will be skipped instead
+        QObject::connect(device, &GearBase::isConnectedChanged, q, [this, device](bool isConnected){
+            if (!isConnected) {
+                wakeLane(device->deviceID());
+            }
+        });
+    }
+
+    // Start the entry at the front of the given lane, if it is ready to go. If the entry
+    // was skipped, this returns the lanes it was in, as they will want to move on as well.
+    QStringList advance(const QString& laneID)
+    {
+        Lane* theLane = lanes.value(laneID);
+        if (theLane && theLane->handle == 0 && theLane->pending.count() > 0) {
+            theLane->waitingForGroup = false;
+            const int index = model->indexOf(theLane->pending.first());
+            if (index > -1 && isStartable(model->at(index))) {
+                const QStringList entryLanes = model->at(index).lanes;
+                if (isWaitingForGroup(model->at(index))) {
+                    // Every one of the devices needs to be ready, so any of them finishing
+                    // their command might be what lets the entry start
+                    for (const QString& entryLane : entryLanes) {
+                        lanes.value(entryLane)->waitingForGroup = true;
+                        lanes.value(entryLane)->heldForGroup = true;
+                    }
+                    return QStringList{};
+                }
+                if (!start(index)) {
+                    return entryLanes;
+                }
+            }
+        }
+        return QStringList{};
+    }
+
+    // When the entry before the one with the given sequence number in the lane is expected
+    // to end, or if there is nothing before it, when the lane itself is expected to be free
+    qint64 laneFreeBefore(const Lane* theLane, quint64 sequence, qint64 now) const
+    {
+        const int position = int(std::lower_bound(theLane->pending.cbegin(), theLane->pending.cend(), sequence) - theLane->pending.cbegin());
+        if (position > 0) {
+            const Entry& previous = model->at(model->indexOf(theLane->pending.at(position - 1)));
+            return previous.startsAt + previous.duration;
+        }
+        return theLane->handle != 0 ? theLane->freeAtEpoch : now;
+    }
+
+    // The position of the first entry in the queue with at least the given sequence number
+    int firstIndexFrom(quint64 sequence) const
+    {
+        int first{0};
+        int last{model->count()};
+        while (first < last) {
+            const int middle = first + (last - first) / 2;
+            if (model->at(middle).sequence < sequence) {
+                first = middle + 1;
+            } else {
+                last = middle;
+            }
+        }
+        return first;
+    }
+
+    // Work out when each entry is expected to start, and when the queue is expected to be
+    // empty. Each entry starts once all its lanes are free, which for a single lane is simply
+    // the running total of the durations. Only the new entries, and those in the lanes which
+    // changed since last time, are worked out again, and a lane stops being changed as soon as
+    // one of its entries turns out to start when it already did, as the rest then stay put.
+    // As the results are absolute times, they stay valid until the queue changes again, so
+    // asking for them (including in the replicas) does not need any further work.
+    void updatePlan()
+    {
+        const qint64 now = QDateTime::currentMSecsSinceEpoch();
+        if (replanEverything) {
+            changedLanes = QSet<QString>(lanes.keyBegin(), lanes.keyEnd());
+        }
+        // Changes to a lane might affect any of its entries, whereas new entries only affect
+        // those after them
+        int i = changedLanes.isEmpty() ? firstIndexFrom(unplannedFrom) : 0;
+        for (; i < model->count(); ++i) {
+            const Entry& entry = model->at(i);
+            // Nothing has a start time before it has been planned
+            const bool unplanned = (entry.startsAt == 0);
+            if (changedLanes.isEmpty() && entry.sequence > unplannedUntil) {
+                break;
+            }
+            bool affected{unplanned || replanEverything};
+            for (const QString& laneID : entry.lanes) {
+                affected = affected || changedLanes.contains(laneID);
+            }
+            if (!affected) {
+                continue;
+            }
+            qint64 startsAt{now};
+            for (const QString& laneID : entry.lanes) {
+                startsAt = qMax(startsAt, laneFreeBefore(lanes.value(laneID), entry.sequence, now));
+            }
+            if (startsAt != entry.startsAt) {
+                model->setStartsAt(i, startsAt);
+                for (const QString& laneID : entry.lanes) {
+                    changedLanes.insert(laneID);
+                }
+            } else if (!replanEverything) {
+                for (const QString& laneID : entry.lanes) {
+                    changedLanes.remove(laneID);
+                }
+            }
+        }
+        changedLanes.clear();
+        unplannedFrom = std::numeric_limits<quint64>::max();
+        unplannedUntil = 0;
+        replanEverything = false;
+
+        qint64 emptyAt{0};
+        for (const Lane* theLane : std::as_const(lanes)) {
+            if (!theLane->pending.isEmpty()) {
+                const Entry& last = model->at(model->indexOf(theLane->pending.last()));
+                emptyAt = qMax(emptyAt, last.startsAt + last.duration);
+            } else if (theLane->handle != 0) {
+                emptyAt = qMax(emptyAt, theLane->freeAtEpoch);
+            }
+        }
+        if (queueEmptyAt != emptyAt) {
+            queueEmptyAt = emptyAt;
+            Q_EMIT q->queueEmptyAtChanged(queueEmptyAt);
+        }
+    }
+
+    // Keep going until all the given lanes are either busy or have nothing ready to start,
+    // without recursing through a long run of skipped entries
+    void advanceLanes(const QStringList& laneIDs)
+    {
+        QStringList toAdvance = laneIDs;
+        while (!toAdvance.isEmpty()) {
+            const QStringList skippedLanes = advance(toAdvance.takeFirst());
+            for (const QString& laneID : skippedLanes) {
+                if (!toAdvance.contains(laneID)) {
+                    toAdvance << laneID;
+                }
+            }
+        }
+        updatePlan();
+    }
 };
 
 CommandQueue::CommandQueue(BTConnectionManager* connectionManager)
     : CommandQueueProxySource(connectionManager)
     , d(new Private(this, connectionManager))
 {
-    d->popTimer = new QTimer(this);
-    d->popTimer->setSingleShot(true);
-    connect(d->popTimer, &QTimer::timeout, this, [this](){ d->pop(); });
-
-    connect(d->currentCommandTimerChecker, &QTimer::timeout, [this](){
-        Q_EMIT currentCommandRemainingMSecondsChanged(d->currentCommandTimer->remainingTime());
-    });
+    DeviceModel* deviceModel = qobject_cast<DeviceModel*>(connectionManager->deviceModel());
+    connect(deviceModel, &DeviceModel::deviceAdded, this, [this](GearBase* device){ d->registerDevice(device); });
+    for (int i = 0; i < deviceModel->count(); ++i) {
+        d->registerDevice(deviceModel->getDeviceById(i));
+    }
 }
 
 CommandQueue::~CommandQueue()
@@ -100,83 +691,77 @@ CommandQueue::~CommandQueue()
     delete d;
 }
 
-QHash<int, QByteArray> CommandQueue::roleNames() const
+QAbstractItemModel * CommandQueue::entries() const
 {
-    static const QHash<int, QByteArray> roles{
-        {Name, "name"},
-        {Command, "command"},
-        {IsRunning, "isRunning"},
-        {Category, "category"},
-        {Duration, "duration"},
-        {MinimumCooldown, "minimumCooldown"}
-    };
-    return roles;
+    return d->model;
 }
 
-QVariant CommandQueue::data(const QModelIndex& index, int role) const
+int CommandQueue::count() const
 {
-    QVariant value;
-    if(index.isValid() && index.row() > -1 && index.row() < d->commands.count()) {
-        Private::Entry* entry = d->commands.at(index.row());
-        switch(role) {
-            case Name:
-                value = entry->command.name;
-                break;
-            case Command:
-                value = entry->command.command;
-                break;
-            case IsRunning:
-                value = entry->command.isRunning;
-                break;
-            case Category:
-                value = entry->command.category;
-                break;
-            case Duration:
-                value = entry->command.duration;
-                break;
-            case MinimumCooldown:
-                value = entry->command.minimumCooldown;
-                break;
-            default:
-                break;
-        }
-    };
-    return value;
+    return d->model->count();
 }
 
-int CommandQueue::rowCount(const QModelIndex& parent) const
+int CommandQueue::skippedCount() const
 {
-    if(parent.isValid()) {
-        return 0;
+    return d->skippedCount;
+}
+
+qint64 CommandQueue::queueEmptyAt() const
+{
+    return d->queueEmptyAt;
+}
+
+qint64 CommandQueue::timeUntilEntry(int index) const
+{
+    if (index >= 0 && index < d->model->count()) {
+        return qMax<qint64>(0, d->model->at(index).startsAt - QDateTime::currentMSecsSinceEpoch());
     }
-    return d->commands.count();
+    return -1;
 }
 
-int CommandQueue::count() const
+qint64 CommandQueue::timeUntilEmpty() const
 {
-    return d->commands.count();
+    return qMax<qint64>(0, d->queueEmptyAt - QDateTime::currentMSecsSinceEpoch());
 }
 
 int CommandQueue::currentCommandRemainingMSeconds() const
 {
-    return d->currentCommandTimer->remainingTime();
+    return int(d->currentCommandEnd.remainingTime());
+}
+
+qint64 CommandQueue::currentCommandStarted() const
+{
+    return d->currentCommandStarted;
+}
+
+qint64 CommandQueue::currentCommandDeadline() const
+{
+    return d->currentCommandDeadline;
 }
 
 int CommandQueue::currentCommandTotalDuration() const
 {
-    return d->currentCommandTimer->interval();
+    return d->currentCommandDuration;
 }
 
 void CommandQueue::clear(const QString& deviceID)
 {
-    // Before doing anything else, ensure the timer doesn't suddenly pick stuff
+    // Before doing anything else, ensure the lanes don't suddenly pick stuff
     // out from underneath us. Stop all functions and let's do the thing.
-    d->popTimer->stop();
     if (deviceID.isEmpty()) {
-        d->commands.clear();
+        for (Private::Lane* lane : std::as_const(d->lanes)) {
+            d->release(lane);
+            lane->pending.clear();
+        }
+        d->model->clear();
+        d->replanEverything = true;
+        d->updatePlan();
     } else {
         // Remove the command, but only if the command is requested for only that device
         // If the command is requested for other devices as well, remove this device from the list of requesting devices
+        if (d->lanes.contains(deviceID)) {
+            d->clearLane(deviceID);
+        }
     }
     Q_EMIT countChanged(count());
 }
@@ -184,21 +769,7 @@ void CommandQueue::clear(const QString& deviceID)
 void CommandQueue::pushPause(int durationMilliseconds, QStringList devices)
 {
     qDebug() << "Adding a pause to the queue of" << durationMilliseconds << "milliseconds";
-    CommandInfo command;
-    static const QLatin1String pauseName{"Pause"};
-    command.name = pauseName;
-    command.duration = durationMilliseconds;
-
-    Private::Entry* entry = new Private::Entry(command);
-    entry->deviceIDs = devices;
-    d->commands.append(entry);
-    Q_EMIT countChanged(count());
-
-    // If we have just pushed a command and the timer is not currently running,
-    // let's fire one off now!
-    if(!d->popTimer->isActive()) {
-        d->pop();
-    }
+    d->push({pauseCommand(durationMilliseconds)}, devices);
 }
 
 void CommandQueue::pushCommand(QString tailCommand, QStringList devices)
@@ -209,66 +780,82 @@ void CommandQueue::pushCommand(QString tailCommand, QStringList devices)
     if(!command.isValid()) {
         return;
     }
-    Private::Entry* entry = new Private::Entry(command);
-    entry->deviceIDs = devices;
-    d->commands.append(entry);
-    Q_EMIT countChanged(count());
-
-    // If we have just pushed a command and the timer is not currently running,
-    // let's fire one off now!
-    if(!d->popTimer->isActive()) {
-        d->pop();
-    }
+    d->push({command}, devices);
 }
 
-void CommandQueue::pushCommands(CommandInfoList commands, QStringList devices)
+void CommandQueue::pushCommands(CommandInfoList commands, QStringList devices, Priority priority, bool preempt)
 {
-    if(commands.count() > 0) {
-        for (const CommandInfo& command : commands) {
-            Private::Entry* entry = new Private::Entry(command);
-            entry->deviceIDs = devices;
-            d->commands.append(entry);
-        }
-        Q_EMIT countChanged(count());
+    d->push(commands, devices, priority, preempt);
+}
 
-        // If we have just pushed some commands and the timer is not currently
-        // running, let's fire one off now!
-        if(!d->popTimer->isActive()) {
-            d->pop();
-        }
+void CommandQueue::pushUrgentCommand(QString tailCommand, QStringList devices)
+{
+    qDebug() << Q_FUNC_INFO << tailCommand;
+    // Unlike pushCommand, this also accepts the commands which are technically invalid,
+    // but always available (such as the home position), just like sending them directly would
+    const CommandInfo command = qobject_cast<CommandModel *>(d->connectionManager->commandModel())->getCommand(tailCommand);
+    if(command.command.isEmpty()) {
+        return;
     }
+    d->push({command}, devices, UrgentPriority, true);
 }
 
 void CommandQueue::pushCommands(QStringList commands, QStringList devices)
 {
     qDebug() << commands;
+    // Gather up the whole list first, so it can be added to the queue in one go
+    CommandInfoList commandInfos;
+    CommandModel* commandModel = qobject_cast<CommandModel *>(d->connectionManager->commandModel());
     for (auto command : commands) {
         static const QLatin1String pauseString{"pause"};
         if(command.startsWith(pauseString)) {
             static const QLatin1Char comma = QLatin1Char{':'};
             QStringList pauseCommand = command.split(comma);
             if(pauseCommand.count() == 2) {
-                pushPause(pauseCommand[1].toInt() * 1000, devices);
+                commandInfos << CommandQueue::pauseCommand(pauseCommand[1].toInt() * 1000);
             }
         } else {
-            pushCommand(command, devices);
+            const CommandInfo& commandInfo = commandModel->getCommand(command);
+            if(commandInfo.isValid()) {
+                commandInfos << commandInfo;
+            }
         }
     }
+    d->push(commandInfos, devices);
 }
 
 void CommandQueue::removeEntry(int index)
 {
-    d->commands.removeAt(index);
-    Q_EMIT countChanged(count());
+    if(index >= 0 && index < d->model->count()) {
+        const Private::Entry entry = d->model->take(index);
+        for (const QString& laneID : entry.lanes) {
+            d->lanes[laneID]->pending.removeOne(entry.sequence);
+            d->planChanged(laneID);
+        }
+        Q_EMIT countChanged(count());
+        // Whatever was waiting behind the entry might be able to run now
+        d->advanceLanes(entry.lanes);
+    }
 }
 
 void CommandQueue::swapEntries(int swapThis, int withThis)
 {
-    if(swapThis >= 0 && swapThis < d->commands.count() && withThis >= 0 && withThis < d->commands.count()) {
-        Private::Entry* with = d->commands.takeAt(withThis);
-        Private::Entry* swap = d->commands.takeAt(swapThis);
-        d->commands.insert(swapThis, with);
-        d->commands.insert(withThis, swap);
+    if(swapThis >= 0 && swapThis < d->model->count() && withThis >= 0 && withThis < d->model->count()
+        // Entries can only be moved around among those of the same priority
+        && d->model->at(swapThis).priority == d->model->at(withThis).priority) {
+        QStringList lanes = d->model->at(swapThis).lanes;
+        for (const QString& laneID : d->model->at(withThis).lanes) {
+            if (!lanes.contains(laneID)) {
+                lanes << laneID;
+            }
+        }
+        d->model->swapEntries(swapThis, withThis);
+        for (const QString& laneID : std::as_const(lanes)) {
+            d->rebuildLane(laneID);
+        }
+        // The entries now follow on from different ones in their lanes
+        d->replanEverything = true;
+        d->advanceLanes(lanes);
     }
 }
 
@@ -281,3 +868,12 @@ void CommandQueue::moveEntryDown(int index)
 {
     swapEntries(index - 1, index);
 }
+
+CommandInfo CommandQueue::pauseCommand(int durationMilliseconds)
+{
+    CommandInfo command;
+    static const QLatin1String pauseName{"Pause"};
+    command.name = pauseName;
+    command.duration = durationMilliseconds;
+    return command;
+}
@@ -18,7 +18,7 @@
 #ifndef COMMANDQUEUE_H
 #define COMMANDQUEUE_H
 
-#include <QAbstractListModel>
+#include "CommandQueueModel.h"
 #include "GearCommandModel.h"
 #include "rep_CommandQueueProxy_source.h"
 
@@ -35,6 +35,17 @@ class BTConnectionManager;
  * one ended, or with a given pause before the next is launched. This ensures that
  * the tail will not likely end up with the kind of damage which might otherwise
  * occur if we allowed commands to simply be fired off without a cooldown period.
+ *
+ * Each device has its own lane in the queue, and the lanes advance independently
+ * of each other, so a command sent to one piece of gear does not hold up the
+ * commands for another. Commands sent to several devices wait until all those
+ * devices are ready, and then start on all of them together.
+ *
+ * By default a lane moves on once the duration and cooldown described by the
+ * command have passed. If AppSettings::queueFollowsGear is enabled, the lane
+ * instead moves on when the device reports that it has ended the command (plus
+ * the cooldown), and the timer is only used as a fallback in case the device
+ * never tells us.
  */
 class CommandQueue : public CommandQueueProxySource
 {
@@ -43,27 +54,70 @@ public:
     explicit CommandQueue(BTConnectionManager* connectionManager);
     ~CommandQueue() override;
 
-    enum Roles {
-        Name = Qt::UserRole + 1,
-        Command,
-        IsRunning,
-        Category,
-        Duration,
-        MinimumCooldown
+    /**
+     * The priorities commands can be queued up with. Commands with a higher priority
+     * go ahead of everything with a lower priority already in the queue, and otherwise
+     * commands are run in the order they were pushed.
+     */
+    enum Priority {
+        IdlePriority = 0, ///< Things done while nothing else is going on (such as casual mode)
+        NormalPriority, ///< Things explicitly asked for (such as move lists and alarms)
+        UrgentPriority, ///< Things which should happen right away (such as gestures and the home position)
     };
+    Q_ENUM(Priority)
 
-    QHash< int, QByteArray > roleNames() const;
-    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
-    int rowCount(const QModelIndex& parent = QModelIndex()) const;
+    /**
+     * The entries currently waiting in the queue, in the order they are queued up
+     * @return A CommandQueueModel instance
+     */
+    QAbstractItemModel* entries() const override;
     int count() const override;
+    /**
+     * The number of entries which were dropped when it was their turn to run, because
+     * none of the devices they were meant for were connected and knew the command.
+     * Entries whose devices are only busy with another command in the same group are
+     * not skipped, but wait for that command to end.
+     * @return The number of entries skipped since the queue was created
+     */
+    int skippedCount() const override;
+    /**
+     * When everything currently in the queue is expected to be done, taking into account
+     * how long each command takes on the specific devices it is sent to
+     * @return The time in milliseconds since the epoch, or zero if nothing is queued or running
+     */
+    qint64 queueEmptyAt() const override;
+    /**
+     * How long until the entry at the given position in the queue is expected to start
+     * @param index The position of the entry in the queue
+     * @return The time in milliseconds, or -1 if there is no entry at that position
+     */
+    qint64 timeUntilEntry(int index) const;
+    /**
+     * How long until everything currently in the queue is expected to be done
+     * @return The time in milliseconds
+     */
+    qint64 timeUntilEmpty() const;
 
     /**
      * The number of remaining milliseconds of the most recently launched command
      * launched by the queue. If this is zero, consider no command running.
      * @note This also includes the mandatory pause of the command
+     * @note This is not replicated, as it changes constantly. Use currentCommandDeadline instead.
      * @return The remaining runtime of the current command in milliseconds
      */
-    int currentCommandRemainingMSeconds() const override;
+    int currentCommandRemainingMSeconds() const;
+    /**
+     * When the most recently launched command was started, in milliseconds since the epoch
+     * @return The start time of the current command, or zero if nothing has been launched yet
+     */
+    qint64 currentCommandStarted() const override;
+    /**
+     * When the most recently launched command is planned to end, in milliseconds since the epoch.
+     * If this is in the past, consider no command running.
+     * @note This also includes the mandatory pause of the command
+     * @return The end time of the current command, or zero if nothing has been launched yet
+     */
+    qint64 currentCommandDeadline() const override;
     /**
      * The number of milliseconds the current command will run for.
      * @Note, this is not updated until the next command is launched, and not included for pauses.
@@ -71,6 +125,7 @@ public:
     int currentCommandTotalDuration() const override;
     /**
      * Clear the queue of all commands
+     * @param deviceID The device whose commands should be cleared (or an empty string to clear everything)
      */
     Q_SLOT void clear(const QString& deviceID) override;
     /**
@@ -95,8 +150,20 @@ public:
      *
      * @param commands The list of commands to add to the queue
      * @param devices The devices you wish to send the commands to (or an empty list to send to all devices)
+     * @param priority The priority of the commands
+     * @param preempt If true, whatever the devices are currently running is cut short, so the commands start right away
      */
-    Q_SLOT void pushCommands(CommandInfoList commands, QStringList deviceIDs);
+    Q_SLOT void pushCommands(CommandInfoList commands, QStringList deviceIDs, Priority priority = NormalPriority, bool preempt = false);
+    /**
+     * Add a command to the front of the queue, and run it right away, cutting short
+     * whatever the devices are currently running.
+     * Unlike pushCommand, this also accepts commands which are always available, even if
+     * they are not found in the command model (such as TAILHM).
+     *
+     * @param tailCommand The command you wish to run
+     * @param devices The devices you wish to send the command to (or an empty list to send to all devices)
+     */
+    Q_SLOT void pushUrgentCommand(QString tailCommand, QStringList devices) override;
     /**
      * A convenience slot which takes a list of commands, and the special pause command
      * (which is "pause:" followed by an integer number representing the number of seconds
@@ -132,6 +199,13 @@ public:
      * @param index The index of the command to move down one position
      */
     Q_SLOT void moveEntryDown(int index) override;
+
+    /**
+     * Create a pause entry which can be pushed to the queue along with other commands
+     * @param durationMilliseconds The duration of the pause in milliseconds
+     * @return A command which does nothing for the given duration
+     */
+    static CommandInfo pauseCommand(int durationMilliseconds);
 private:
     class Private;
     Private* d;
@@ -0,0 +1,215 @@
+/*
+ *   Copyright 2019 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#include "CommandQueueModel.h"
+
+#include <algorithm>
+
+class CommandQueueModel::Private
+{
+public:
+    Private() {}
+    // Entries are held by value. Taking entries off the front of a QList leaves the
+    // free space at the front for reuse, so as the queue is consumed from the front
+    // and appended to at the back, this works as a ring buffer, and running a long
+    // session of commands through the queue does not keep allocating.
+    QList<Entry> entries;
+    quint64 nextSequence{1};
+};
+
+CommandQueueModel::CommandQueueModel(QObject* parent)
+    : QAbstractListModel(parent)
+    , d(new Private)
+{
+}
+
+CommandQueueModel::~CommandQueueModel()
+{
+    delete d;
+}
+
+QHash<int, QByteArray> CommandQueueModel::roleNames() const
+{
+    static const QHash<int, QByteArray> roles{
+        {Name, "name"},
+        {Command, "command"},
+        {IsRunning, "isRunning"},
+        {Category, "category"},
+        {Duration, "duration"},
+        {MinimumCooldown, "minimumCooldown"},
+        {StartsAt, "startsAt"}
+    };
+    return roles;
+}
+
+QVariant CommandQueueModel::data(const QModelIndex& index, int role) const
+{
+    QVariant value;
+    if(index.isValid() && index.row() > -1 && index.row() < d->entries.count()) {
+        const Entry& entry = d->entries.at(index.row());
+        switch(role) {
+            case Name:
+                value = entry.command.name;
+                break;
+            case Command:
+                value = entry.command.command;
+                break;
+            case IsRunning:
+                value = entry.command.isRunning;
+                break;
+            case Category:
+                value = entry.command.category;
+                break;
+            case Duration:
+                value = entry.command.duration;
+                break;
+            case MinimumCooldown:
+                value = entry.command.minimumCooldown;
+                break;
+            case StartsAt:
+                value = entry.startsAt;
+                break;
+            default:
+                break;
+        }
+    };
+    return value;
+}
+
+int CommandQueueModel::rowCount(const QModelIndex& parent) const
+{
+    if(parent.isValid()) {
+        return 0;
+    }
+    return d->entries.count();
+}
+
+int CommandQueueModel::count() const
+{
+    return d->entries.count();
+}
+
+const CommandQueueModel::Entry & CommandQueueModel::at(int index) const
+{
+    return d->entries.at(index);
+}
+
+int CommandQueueModel::indexOf(quint64 sequence) const
+{
+    auto it = std::lower_bound(d->entries.cbegin(), d->entries.cend(), sequence, [](const Entry& entry, quint64 sequence){ return entry.sequence < sequence; });
+    if (it != d->entries.cend() && it->sequence == sequence) {
+        return int(it - d->entries.cbegin());
+    }
+    return -1;
+}
+
+quint64 CommandQueueModel::insert(const QList<Entry>& entries, int priority)
+{
+    priority = qBound(0, priority, maximumPriority);
+    // Higher priorities need to sort first, so they get the lower numbers
+    const quint64 firstSequence = (quint64(maximumPriority - priority) << 56) | d->nextSequence;
+    if (entries.count() > 0) {
+        // Everything already in the queue at this priority has a lower counter, so this is
+        // the end of that priority's part of the queue
+        auto it = std::lower_bound(d->entries.cbegin(), d->entries.cend(), firstSequence, [](const Entry& entry, quint64 sequence){ return entry.sequence < sequence; });
+        const int first = int(it - d->entries.cbegin());
+        beginInsertRows(QModelIndex(), first, first + entries.count() - 1);
+        d->entries.insert(first, entries.count(), Entry{});
+        for (int i = 0; i < entries.count(); ++i) {
+            Entry& entry = d->entries[first + i];
+            entry = entries.at(i);
+            entry.sequence = firstSequence + i;
+            entry.priority = priority;
+        }
+        d->nextSequence += entries.count();
+        endInsertRows();
+    }
+    return firstSequence;
+}
+
+CommandQueueModel::Entry CommandQueueModel::take(int index)
+{
+    beginRemoveRows(QModelIndex(), index, index);
+    Entry entry = d->entries.takeAt(index);
+    endRemoveRows();
+    return entry;
+}
+
+void CommandQueueModel::removeEntries(const QList<int>& indices)
+{
+    // Work from the back, so the positions we have yet to remove stay put
+    int current = indices.count() - 1;
+    while (current > -1) {
+        const int last = indices.at(current);
+        while (current > 0 && indices.at(current - 1) == indices.at(current) - 1) {
+            --current;
+        }
+        const int first = indices.at(current);
+        beginRemoveRows(QModelIndex(), first, last);
+        d->entries.remove(first, last - first + 1);
+        endRemoveRows();
+        --current;
+    }
+}
+
+void CommandQueueModel::setTargets(int index, const QStringList& deviceIDs, const QStringList& lanes, const QList<GearBase::Program>& programs)
+{
+    Entry& entry = d->entries[index];
+    entry.deviceIDs = deviceIDs;
+    entry.lanes = lanes;
+    entry.programs = programs;
+}
+
+void CommandQueueModel::setStartsAt(int index, qint64 startsAt)
+{
+    if (d->entries.at(index).startsAt != startsAt) {
+        d->entries[index].startsAt = startsAt;
+        const QModelIndex changed = this->index(index);
+        Q_EMIT dataChanged(changed, changed, QVector<int>{StartsAt});
+    }
+}
+
+void CommandQueueModel::swapEntries(int swapThis, int withThis)
+{
+    const int first = qMin(swapThis, withThis);
+    const int second = qMax(swapThis, withThis);
+    if (first == second) {
+        return;
+    }
+    // The sequence numbers stay where they are, so they keep increasing along the queue
+    const quint64 firstSequence = d->entries.at(first).sequence;
+    const quint64 secondSequence = d->entries.at(second).sequence;
+    // A swap is the second entry moving up to where the first one was, and (unless they
+    // were next to each other) the first one moving down to where the second one was
+    beginMoveRows(QModelIndex(), second, second, QModelIndex(), first);
+    d->entries.move(second, first);
+    endMoveRows();
+    if (second > first + 1) {
+        beginMoveRows(QModelIndex(), first + 1, first + 1, QModelIndex(), second + 1);
+        d->entries.move(first + 1, second);
+        endMoveRows();
+    }
+    d->entries[first].sequence = firstSequence;
+    d->entries[second].sequence = secondSequence;
+}
+
+void CommandQueueModel::clear()
+{
+    beginResetModel();
+    d->entries.clear();
+    endResetModel();
+}
@@ -0,0 +1,154 @@
+/*
+ *   Copyright 2019 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#ifndef COMMANDQUEUEMODEL_H
+#define COMMANDQUEUEMODEL_H
+
+#include <QAbstractListModel>
+#include <QDeadlineTimer>
+#include <QStringList>
+
+#include "CommandInfo.h"
+#include "GearBase.h"
+
+/**
+ * @brief The entries waiting in the command queue, in queue order
+ *
+ * This holds the actual entries for the CommandQueue (which does the work of
+ * deciding when to run them), and tells any views (including the replicas in
+ * the UI) about changes to the queue row by row, so they do not have to reload
+ * the whole thing whenever something is pushed or run.
+ *
+ * Entries are queued with a priority, and entries with a higher priority go
+ * ahead of all those with a lower priority. Within the same priority, entries
+ * stay in the order they were added.
+ *
+ * Each entry is given a sequence number when it is added, made up of its priority
+ * (in the highest bits) and a counter. The sequence numbers always increase along
+ * the queue (when entries are swapped, they also swap sequence numbers), so an
+ * entry can be found by its sequence number with a binary search, and the sequence
+ * number can be held onto as a stable way to refer to the entry while it is in
+ * the queue.
+ */
+class CommandQueueModel : public QAbstractListModel
+{
+    Q_OBJECT
+public:
+    explicit CommandQueueModel(QObject* parent = nullptr);
+    ~CommandQueueModel() override;
+
+    enum Roles {
+        Name = Qt::UserRole + 1,
+        Command,
+        IsRunning,
+        Category,
+        Duration,
+        MinimumCooldown,
+        StartsAt
+    };
+
+    /**
+     * The highest priority an entry can be given (the lowest being zero)
+     */
+    static constexpr int maximumPriority{255};
+
+    struct Entry {
+        quint64 sequence{0};
+        int priority{0};
+        CommandInfo command;
+        QStringList deviceIDs;
+        // The lanes this entry will occupy while it runs (resolved when it is pushed)
+        QStringList lanes;
+        // The earliest the entry could have been started
+        QDeadlineTimer pushedAt;
+        // What to send to each device when the entry is run (worked out when it is pushed)
+        QList<GearBase::Program> programs;
+        // How long the entry will occupy its lanes (including the cooldown), and how much of
+        // that is the cooldown, for the devices it is actually sent to
+        int duration{0};
+        int cooldown{0};
+        // When the entry is expected to start, in milliseconds since the epoch (zero until it has been planned)
+        qint64 startsAt{0};
+    };
+
+    QHash< int, QByteArray > roleNames() const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+
+    int count() const;
+    /**
+     * @param index The position in the queue of the entry you want
+     * @return The entry at the given position (which must be valid)
+     */
+    const Entry& at(int index) const;
+    /**
+     * @param sequence The sequence number of the entry you want the position of
+     * @return The position of the entry in the queue, or -1 if it is not in the queue
+     */
+    int indexOf(quint64 sequence) const;
+
+    /**
+     * Add a number of entries to the queue in one go, after all the existing entries
+     * of the same or a higher priority. The entries are given sequence numbers in the
+     * order they are passed in.
+     * @param entries The entries to add (their sequence numbers and priorities are ignored)
+     * @param priority The priority of the new entries (clamped to between zero and maximumPriority)
+     * @return The sequence number given to the first of the new entries (the rest follow on from that)
+     */
+    quint64 insert(const QList<Entry>& entries, int priority);
+    /**
+     * Remove the entry at the given position from the queue
+     * @param index The position of the entry to remove (which must be valid)
+     * @return The entry which was removed
+     */
+    Entry take(int index);
+    /**
+     * Remove the entries at the given positions from the queue. Neighbouring
+     * entries are removed together.
+     * @param indices The positions of the entries to remove, in increasing order
+     */
+    void removeEntries(const QList<int>& indices);
+    /**
+     * Change which devices the entry at the given position is to be sent to
+     * @param index The position of the entry to change (which must be valid)
+     * @param deviceIDs The devices the entry should be sent to
+     * @param lanes The lanes the entry should occupy while it runs
+     * @param programs What to send to each of the devices
+     */
+    void setTargets(int index, const QStringList& deviceIDs, const QStringList& lanes, const QList<GearBase::Program>& programs);
+    /**
+     * Set when the entry at the given position is expected to start. The row is only
+     * reported as changed if the start time actually changed.
+     * @param index The position of the entry to change (which must be valid)
+     * @param startsAt The start time, in milliseconds since the epoch
+     */
+    void setStartsAt(int index, qint64 startsAt);
+    /**
+     * Swap two entries in the queue
+     * @note This should only be done for entries of the same priority, or the queue will end up out of order
+     */
+    void swapEntries(int swapThis, int withThis);
+    /**
+     * Remove all entries from the queue
+     */
+    void clear();
+private:
+    class Private;
+    Private* d;
+};
+
+#endif//COMMANDQUEUEMODEL_H
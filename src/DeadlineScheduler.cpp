@@ -0,0 +1,225 @@
+/*
+ *   Copyright 2019 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#include "DeadlineScheduler.h"
+
+#include <QDebug>
+#include <QMap>
+#include <QPointer>
+#include <QTimer>
+
+#include <limits>
+
+class DeadlineScheduler::Private
+{
+public:
+    Private(DeadlineScheduler* qq)
+        : q(qq)
+    {
+        // Each queue's timer only ever runs for that queue's earliest deadline. Steps in
+        // the command queue want waking up as close to that as possible, whereas the rest
+        // is happy to be woken up whenever is convenient, which saves on battery.
+        precise.timer = createTimer(Qt::PreciseTimer);
+        coarse.timer = createTimer(Qt::CoarseTimer);
+    }
+    DeadlineScheduler* q{nullptr};
+
+    struct Job {
+        QPointer<QObject> context;
+        std::function<void()> callback;
+    };
+    // Ordered by deadline (in nanoseconds on the monotonic clock), and then by the
+    // order they were scheduled in, so things due at the same time run in order
+    using Key = QPair<qint64, Handle>;
+    struct Queue {
+        QTimer* timer{nullptr};
+        QMap<Key, Job> jobs;
+    };
+    Queue precise;
+    Queue coarse;
+    QHash<Handle, qint64> deadlines;
+    QHash<Handle, Queue*> queues;
+    Handle lastHandle{0};
+
+    // Anything later than this gets noted in the log
+    static constexpr qint64 jitterWarningThreshold{50};
+    qint64 lastJitter{0};
+    qint64 maximumJitter{0};
+    qint64 totalJitter{0};
+    qint64 jitterCount{0};
+
+    static qint64 now()
+    {
+        return QDeadlineTimer::current(Qt::PreciseTimer).deadlineNSecs();
+    }
+
+    QTimer* createTimer(Qt::TimerType timerType)
+    {
+        QTimer* timer = new QTimer(q);
+        timer->setSingleShot(true);
+        timer->setTimerType(timerType);
+        Queue* queue = (timerType == Qt::PreciseTimer) ? &precise : &coarse;
+        QObject::connect(timer, &QTimer::timeout, q, [this, queue](){ runDue(*queue); });
+        return timer;
+    }
+
+    Queue& queueFor(Qt::TimerType timerType)
+    {
+        return (timerType == Qt::PreciseTimer) ? precise : coarse;
+    }
+
+    void rearm(Queue& queue)
+    {
+        if (queue.jobs.isEmpty()) {
+            queue.timer->stop();
+        } else {
+            // Round up, so we never wake up before the deadline is actually reached. The timer
+            // only takes an int, so anything further off than that (or a coarse timer firing a
+            // little early) simply has us wake up early, find that nothing is due yet, and go
+            // back to sleep for the rest of the time.
+            const qint64 remaining = qMax<qint64>(0, queue.jobs.firstKey().first - now());
+            queue.timer->start(int(qMin<qint64>(std::numeric_limits<int>::max(), remaining / 1000000 + (remaining % 1000000 > 0 ? 1 : 0))));
+        }
+    }
+
+    void recordJitter(qint64 jitter)
+    {
+        lastJitter = jitter;
+        maximumJitter = qMax(maximumJitter, jitter);
+        totalJitter += jitter;
+        ++jitterCount;
+        if (jitter > jitterWarningThreshold) {
+            qDebug() << "Scheduled callback ran" << jitter << "milliseconds late";
+        }
+        Q_EMIT q->jitterMeasured(jitter);
+    }
+
+    void runDue(Queue& queue)
+    {
+        while (!queue.jobs.isEmpty()) {
+            const qint64 current = now();
+            const Key key = queue.jobs.firstKey();
+            if (key.first > current) {
+                break;
+            }
+            // Take the job out before running it, as the callback may well schedule
+            // (or cancel) other things
+            const Job job = queue.jobs.take(key);
+            deadlines.remove(key.second);
+            queues.remove(key.second);
+            // Jobs whose context has gone away are simply dropped, and as nothing is run
+            // for them, how late they were says nothing about how well we keep time. Nor
+            // does anything on the coarse timer, which was never meant to be on time.
+            if (job.context) {
+                if (&queue == &precise) {
+                    recordJitter((current - key.first) / 1000000);
+                }
+                job.callback();
+            }
+        }
+        rearm(queue);
+    }
+};
+
+DeadlineScheduler::DeadlineScheduler(QObject* parent)
+    : QObject(parent)
+    , d(new Private(this))
+{
+}
+
+DeadlineScheduler::~DeadlineScheduler()
+{
+    delete d;
+}
+
+QDeadlineTimer DeadlineScheduler::deadlineIn(qint64 msecs)
+{
+    return QDeadlineTimer(msecs, Qt::PreciseTimer);
+}
+
+DeadlineScheduler::Handle DeadlineScheduler::scheduleAt(const QDeadlineTimer& deadline, QObject* context, std::function<void()> callback, Qt::TimerType timerType)
+{
+    const Handle handle = ++d->lastHandle;
+    const qint64 deadlineNSecs = deadline.deadlineNSecs();
+    Private::Queue& queue = d->queueFor(timerType);
+    queue.jobs.insert(Private::Key{deadlineNSecs, handle}, Private::Job{context, callback});
+    d->deadlines.insert(handle, deadlineNSecs);
+    d->queues.insert(handle, &queue);
+    if (queue.jobs.firstKey().second == handle) {
+        d->rearm(queue);
+    }
+    return handle;
+}
+
+DeadlineScheduler::Handle DeadlineScheduler::scheduleIn(qint64 msecs, QObject* context, std::function<void()> callback, Qt::TimerType timerType)
+{
+    return scheduleAt(deadlineIn(msecs), context, callback, timerType);
+}
+
+void DeadlineScheduler::cancel(Handle handle)
+{
+    const auto deadline = d->deadlines.constFind(handle);
+    if (deadline != d->deadlines.constEnd()) {
+        Private::Queue& queue = *d->queues.take(handle);
+        const bool wasFirst = (queue.jobs.firstKey().second == handle);
+        queue.jobs.remove(Private::Key{deadline.value(), handle});
+        d->deadlines.erase(deadline);
+        if (wasFirst) {
+            d->rearm(queue);
+        }
+    }
+}
+
+bool DeadlineScheduler::isScheduled(Handle handle) const
+{
+    return d->deadlines.contains(handle);
+}
+
+qint64 DeadlineScheduler::remainingTime(Handle handle) const
+{
+    const auto deadline = d->deadlines.constFind(handle);
+    if (deadline != d->deadlines.constEnd()) {
+        return qMax<qint64>(0, (deadline.value() - Private::now()) / 1000000);
+    }
+    return 0;
+}
+
+qint64 DeadlineScheduler::lastJitter() const
+{
+    return d->lastJitter;
+}
+
+qint64 DeadlineScheduler::maximumJitter() const
+{
+    return d->maximumJitter;
+}
+
+double DeadlineScheduler::averageJitter() const
+{
+    if (d->jitterCount > 0) {
+        return double(d->totalJitter) / d->jitterCount;
+    }
+    return 0;
+}
+
+void DeadlineScheduler::resetJitterStatistics()
+{
+    d->lastJitter = 0;
+    d->maximumJitter = 0;
+    d->totalJitter = 0;
+    d->jitterCount = 0;
+}
@@ -0,0 +1,128 @@
+/*
+ *   Copyright 2019 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#ifndef DEADLINESCHEDULER_H
+#define DEADLINESCHEDULER_H
+
+#include <QDeadlineTimer>
+#include <QObject>
+
+#include <functional>
+
+/**
+ * @brief The one clock used for timing things in the service
+ *
+ * Rather than each part of the service running its own (coarse) timers, things
+ * which need to happen at a specific point in time are scheduled here, against
+ * absolute deadlines on the monotonic clock. This means that when stepping through
+ * a list of things, the next step can be scheduled from when the previous step
+ * was supposed to happen, rather than from when it actually happened, and so the
+ * small delays in waking up do not add up over a long list of moves.
+ *
+ * Only the things which need to stay on the beat ask for a precise wakeup. Everything
+ * else is run off a coarse timer, so the system is free to batch those wakeups together.
+ *
+ * The scheduler also keeps track of how late it is in running the things it was
+ * asked to run (the jitter), which is useful to know when looking into whether
+ * long choreographies stay on beat.
+ */
+class DeadlineScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    ~DeadlineScheduler() override;
+
+    static DeadlineScheduler* getInstance() {
+        static DeadlineScheduler* instance = nullptr;
+        if(!instance) {
+            instance = new DeadlineScheduler();
+        }
+        return instance;
+    }
+
+    /**
+     * Identifies a scheduled callback. Zero is never used for a scheduled callback,
+     * and so can be used to mean "nothing scheduled".
+     */
+    using Handle = quint64;
+
+    /**
+     * Create a deadline the given number of milliseconds from now, with the precision
+     * the scheduler works at
+     * @param msecs The number of milliseconds from now the deadline should be
+     * @return A deadline on the monotonic clock
+     */
+    static QDeadlineTimer deadlineIn(qint64 msecs);
+
+    /**
+     * Run the callback once the deadline has been reached
+     * @param deadline The absolute point in time at which the callback should be run
+     * @param context If this object is destroyed before the deadline, the callback is not run
+     * @param callback The function to run
+     * @param timerType Qt::PreciseTimer for things which need to happen on the beat (such as the
+     * steps in the command queue), or Qt::CoarseTimer for things which can happen a little later
+     * if that means the system can sleep for longer (only precise callbacks count towards jitter)
+     * @return A handle which can be used to cancel the callback, or ask when it will run
+     */
+    Handle scheduleAt(const QDeadlineTimer& deadline, QObject* context, std::function<void()> callback, Qt::TimerType timerType = Qt::CoarseTimer);
+    /**
+     * Convenience version of scheduleAt, which runs the callback the given number of
+     * milliseconds from now
+     */
+    Handle scheduleIn(qint64 msecs, QObject* context, std::function<void()> callback, Qt::TimerType timerType = Qt::CoarseTimer);
+    /**
+     * Stop the callback with the given handle from being run. Cancelling something
+     * which has already been run (or cancelled) is harmless.
+     */
+    void cancel(Handle handle);
+    /**
+     * @return Whether the callback with the given handle is still waiting to be run
+     */
+    bool isScheduled(Handle handle) const;
+    /**
+     * @return The number of milliseconds until the callback with the given handle is run,
+     * or zero if it is not scheduled
+     */
+    qint64 remainingTime(Handle handle) const;
+
+    /**
+     * @return How late, in milliseconds, the most recently run precise callback was run
+     */
+    qint64 lastJitter() const;
+    /**
+     * @return The latest any callback has been run (in milliseconds) since the statistics were last reset
+     */
+    qint64 maximumJitter() const;
+    /**
+     * @return The average lateness (in milliseconds) of the callbacks run since the statistics were last reset
+     */
+    double averageJitter() const;
+    /**
+     * Forget all the jitter measured so far
+     */
+    Q_SLOT void resetJitterStatistics();
+    /**
+     * Fired whenever a callback has been run, with how late it was run (in milliseconds)
+     */
+    Q_SIGNAL void jitterMeasured(qint64 jitter);
+private:
+    explicit DeadlineScheduler(QObject* parent = nullptr);
+    class Private;
+    Private* d;
+};
+
+#endif//DEADLINESCHEDULER_H
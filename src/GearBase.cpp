@@ -22,7 +22,6 @@
 #include <QCryptographicHash>
 #include <QFile>
 #include <QSettings>
-#include <QTimer>
 
 #include "AppSettings.h"
 #include "CommandPersistence.h"
@@ -70,6 +69,43 @@ public:
     QHash<GearBase::GearSensorEvent, GearSensorEventDetails> gearSensorEvents;
 
     bool isLoading{false};
+    int commandsRevision{0};
+
+    // The commands currently running on the device, in the order they were started, and their names
+    QList<CommandAtoms::Atom> activeCommands;
+    QStringList activeCommandTitles;
+    void commandRunningChanged(CommandAtoms::Atom command, bool isRunning) {
+        const int position = activeCommands.indexOf(command);
+        if (isRunning && position == -1) {
+            const int row = q->commandModel->indexOf(command);
+            activeCommands << command;
+            activeCommandTitles << (row > -1 ? q->commandModel->allCommands().at(row).name : CommandAtoms::string(command));
+            Q_EMIT q->activeCommandTitlesChanged(activeCommandTitles);
+        } else if (!isRunning && position > -1) {
+            activeCommands.removeAt(position);
+            activeCommandTitles.removeAt(position);
+            Q_EMIT q->activeCommandTitlesChanged(activeCommandTitles);
+        }
+    }
+    // When the commands are replaced wholesale, work out afresh which are running
+    void commandsReset() {
+        QList<CommandAtoms::Atom> stillActive;
+        QStringList stillActiveTitles;
+        const CommandInfoList& commands = q->commandModel->allCommands();
+        for (int row = 0; row < commands.count(); ++row) {
+            if (q->commandModel->isRunningAt(row) && !stillActive.contains(commands.at(row).id())) {
+                stillActive << commands.at(row).id();
+                stillActiveTitles << commands.at(row).name;
+            }
+        }
+        if (stillActiveTitles != activeCommandTitles) {
+            activeCommands = stillActive;
+            activeCommandTitles = stillActiveTitles;
+            Q_EMIT q->activeCommandTitlesChanged(activeCommandTitles);
+        } else {
+            activeCommands = stillActive;
+        }
+    }
 };
 
 GearBase::GearBase(const QBluetoothDeviceInfo& info, DeviceModel * parent)
@@ -92,11 +128,9 @@ GearBase::GearBase(const QBluetoothDeviceInfo& info, DeviceModel * parent)
     }
     d->parentModel = parent;
 
-    QTimer* timer = new QTimer(this);
-    timer->setInterval(1);
-    timer->setSingleShot(true);
-    connect(timer, &QTimer::timeout, this, [this](){ Q_EMIT activeCommandTitlesChanged(activeCommandTitles()); });
-    connect(commandModel, &QAbstractItemModel::dataChanged, this, [timer](const QModelIndex& /*topLeft*/, const QModelIndex& /*bottomRight*/, const QVector< int >& /*roles*/){ timer->start(); });
+    connect(commandModel, &GearCommandModel::commandRunningChanged, this, [this](CommandAtoms::Atom command, bool isRunning){ d->commandRunningChanged(command, isRunning); });
+    connect(commandModel, &QAbstractItemModel::modelReset, this, [this](){ d->commandsReset(); });
+    connect(commandModel, &QAbstractItemModel::rowsRemoved, this, [this](){ d->commandsReset(); });
 
     d->load();
     connect(this, &GearBase::isKnownChanged, this, [this](){ d->save(); });
@@ -320,17 +354,9 @@ void GearBase::setBatteryLevelPercent(int batteryLevelPercent)
     }
 }
 
-QString GearBase::activeCommandTitles() const
+QStringList GearBase::activeCommandTitles() const
 {
-    QString titles;
-    QString separator;
-    for(const CommandInfo& command : commandModel->allCommands()) {
-        if (command.isRunning) {
-            titles += separator + command.name;
-            separator = QLatin1String{", "};
-        }
-    }
-    return titles;
+    return d->activeCommandTitles;
 }
 
 QStringList GearBase::enabledCommandsFiles() const
@@ -357,27 +383,101 @@ void GearBase::setCommandsFileEnabledState(const QString& filename, bool enabled
 }
 
 void GearBase::reloadCommands() {
-    commandModel->clear();
+    ++d->commandsRevision;
     commandShorthands.clear();
-    QVariantMap commandFiles = d->parentModel->appSettings()->commandFiles();
+    CommandInfoList commands;
+    AppSettings* appSettings = d->parentModel->appSettings();
     // If there are no enabled files, we'll load the default, so we don't end up with no commands at all
     QStringList enabledFiles = d->enabledCommandsFiles.count() > 0 ? d->enabledCommandsFiles : defaultCommandFiles();
     for (const QString& enabledFile : enabledFiles) {
-        QVariantMap file = commandFiles[enabledFile].toMap();
-        CommandPersistence persistence;
-        persistence.deserialize(file[QLatin1String{"contents"}].toString());
-        if (persistence.error().isEmpty()) {
-            for (const CommandInfo &command : persistence.commands()) {
-                commandModel->addCommand(command);
-            }
-            for (const CommandShorthand& shorthand : persistence.shorthands()) {
+        // The files were parsed when their contents were set, so all we do here is pick up the results
+        const AppSettings::CommandFileData file = appSettings->commandFileData(enabledFile);
+        if (file.isValid) {
+            commands << file.commands;
+            for (const CommandShorthand& shorthand : file.shorthands) {
                 commandShorthands[shorthand.command] = shorthand.expansion.join(QChar::fromLatin1(';'));
             }
         }
         else {
-            qWarning() << "Failure in loading the commands data for" << enabledFile << "with the error:" << persistence.error();
+            qWarning() << "Failure in loading the commands data for" << enabledFile << "with the error:" << file.error;
         }
     }
+    // Swap the whole lot in at once, rather than telling everybody about each command in turn
+    commandModel->setCommands(commands);
+}
+
+GearBase::Program GearBase::compileMessage(const QString& message)
+{
+    static const QLatin1Char semicolon{';'};
+    Program program;
+    program.device = this;
+    program.revision = d->commandsRevision;
+    program.message = message;
+    program.messageID = CommandAtoms::find(message);
+    const QString actualMessage = commandShorthands.value(message, message);
+    program.isExpanded = (actualMessage != message);
+    program.firstCall = actualMessage;
+    if (actualMessage.contains(semicolon)) {
+        program.hasCallQueue = true;
+        program.callQueue = actualMessage.split(semicolon);
+        program.firstCall = program.callQueue.takeFirst();
+    }
+    program.encodedFirstCall = program.firstCall.toUtf8();
+    return program;
+}
+
+void GearBase::sendProgram(const Program& program)
+{
+    if (program.revision == d->commandsRevision) {
+        writeProgram(program);
+    } else {
+        // The shorthands might have changed since the program was compiled, so start over
+        writeProgram(compileMessage(program.message));
+    }
+}
+
+int GearBase::commandsRevision() const
+{
+    return d->commandsRevision;
+}
+
+void GearBase::cancelCalls()
+{
+    callQueue.clear();
+    DeadlineScheduler::getInstance()->cancel(pauseHandle);
+    pauseHandle = 0;
+}
+
+bool GearBase::sendNextCall(const QDeadlineTimer& previousCallEnded)
+{
+    if (callQueue.isEmpty()) {
+        return false;
+    }
+    int pauseDuration{0};
+    QString message = callQueue.takeFirst();
+    while (message.startsWith(QLatin1String{"PAUSE"})) {
+        QStringList pauseCommand = message.split(QLatin1Char{' '});
+        int pause = pauseCommand.value(1).toInt();
+        pauseDuration += pause;
+        message = callQueue.isEmpty() ? QString{} : callQueue.takeFirst();
+        qDebug() << name() << deviceID() << "Found a pause, so we're now waiting" << pauseDuration << "milliseconds";
+    }
+    if (pauseDuration > 0) {
+        // Just in case some funny person stuck a pause at the end...
+        if (message.length() > 0) {
+            // Clamp the max single pause duration to 3000 ms (the conceptual human moment)
+            pauseHandle = DeadlineScheduler::getInstance()->scheduleAt(previousCallEnded + qMax(3000, pauseDuration), this, [this, message](){ pauseHandle = 0; sendMessage(message); }, Qt::PreciseTimer);
+        }
+    }
+    else {
+        sendMessage(message);
+    }
+    return true;
+}
+
+void GearBase::writeProgram(const Program& program)
+{
+    sendMessage(program.message);
 }
 
 QStringList GearBase::defaultCommandFiles() const
@@ -19,10 +19,12 @@
 #define BTDEVICE_H
 
 #include <QObject>
+#include <QPointer>
 #include <QBluetoothDeviceInfo>
 #include <QBluetoothAddress>
 #include <QLowEnergyController>
 
+#include "DeadlineScheduler.h"
 #include "GearCommandModel.h"
 #include "DeviceModel.h"
 
@@ -38,7 +40,7 @@ class GearBase : public QObject
     Q_PROPERTY(QString name READ name WRITE setName NOTIFY nameChanged)
     Q_PROPERTY(QString version READ version NOTIFY versionChanged)
     Q_PROPERTY(QString currentCall READ currentCall NOTIFY currentCallChanged)
-    Q_PROPERTY(QString activeCommandTitles READ activeCommandTitles NOTIFY activeCommandTitlesChanged)
+    Q_PROPERTY(QStringList activeCommandTitles READ activeCommandTitles NOTIFY activeCommandTitlesChanged)
     Q_PROPERTY(int batteryLevel READ batteryLevel NOTIFY batteryLevelChanged)
     Q_PROPERTY(int batteryLevelPercent READ batteryLevelPercent NOTIFY batteryLevelPercentChanged)
     Q_PROPERTY(QString deviceID READ deviceID CONSTANT)
@@ -113,8 +115,15 @@ public:
     virtual QString currentCall() const = 0;
     Q_SIGNAL void currentCallChanged(QString currentCall);
 
-    virtual QString activeCommandTitles() const;
-    Q_SIGNAL void activeCommandTitlesChanged(QString activeCommandTitles);
+    /**
+     * The names of the commands currently running on the device, in the order they were started
+     */
+    virtual QStringList activeCommandTitles() const;
+    /**
+     * Emitted when a command starts or stops running on the device (and not when anything
+     * else about the commands changes)
+     */
+    Q_SIGNAL void activeCommandTitlesChanged(QStringList activeCommandTitles);
 
     virtual int batteryLevel() const = 0;
     Q_SIGNAL void batteryLevelChanged(int batteryLevel);
@@ -130,6 +139,52 @@ public:
 
     virtual void sendMessage(const QString &message) = 0;
 
+    /**
+     * A message worked out ahead of time for sending to a specific device, with
+     * any shorthand expanded and the first call already encoded, so that sending
+     * it later does not need any further work. Create one using compileMessage()
+     * and send it using sendProgram().
+     */
+    struct Program {
+        QPointer<GearBase> device;
+        // The revision of the device's commands the program was compiled against
+        int revision{-1};
+        // The message as requested (which is what will be marked as running), and its atom
+        // (zero if the message is not a known command)
+        QString message;
+        CommandAtoms::Atom messageID{0};
+        // The first call to write to the device, and the same thing ready to be written
+        QString firstCall;
+        QByteArray encodedFirstCall;
+        // Whether the message was a shorthand for something else
+        bool isExpanded{false};
+        // Whether the message is made up of several calls, and what is left to send after the first one
+        bool hasCallQueue{false};
+        QStringList callQueue;
+    };
+    /**
+     * Work out how to send the given message to this device
+     * @param message The message to compile
+     * @return A program which can be sent to the device using sendProgram()
+     */
+    Program compileMessage(const QString &message);
+    /**
+     * Send a message which was compiled ahead of time. If the device's commands
+     * have been reloaded since the program was compiled, it is compiled again first.
+     * @param program A program compiled by this device's compileMessage()
+     */
+    void sendProgram(const Program &program);
+    /**
+     * Stop sending the rest of whatever multi-call message is currently being sent to the
+     * device (including any pause it is waiting out between calls), for example when the
+     * command is cut short by something more urgent.
+     */
+    void cancelCalls();
+    /**
+     * Increased whenever the commands (and shorthands) are reloaded
+     */
+    int commandsRevision() const;
+
     Q_SIGNAL void deviceMessage(const QString& deviceID, const QString& message);
     Q_SIGNAL void deviceBlockingMessage(const QString& title, const QString& message);
 
@@ -204,6 +259,31 @@ public:
     QString knownFirmwareMessage() const;
     void setKnownFirmwareMessage(const QString& knownFirmwareMessage);
     Q_SIGNAL void knownFirmwareMessageChanged();
+protected:
+    /**
+     * Actually write a compiled program to the device. The default implementation
+     * simply sends the program's message using sendMessage(), so only gear which
+     * knows about shorthands needs to implement this.
+     * @param program A program compiled against the device's current commands
+     */
+    virtual void writeProgram(const Program &program);
+    /**
+     * What is left to send of a message made up of several calls (see Program::callQueue),
+     * for gear which sends them one at a time, as the device reports each one ended
+     */
+    QStringList callQueue;
+    /**
+     * The next call in callQueue, while waiting out a pause in it (or zero when not waiting)
+     */
+    DeadlineScheduler::Handle pauseHandle{0};
+    /**
+     * Send the next call in callQueue, once any pauses in front of it have been waited out.
+     * The pauses are counted from when the device reported the previous call ended, rather
+     * than from whenever we got around to looking at the queue, so they stay on the beat.
+     * @param previousCallEnded When the device reported that the previous call ended
+     * @return False if there was nothing left in callQueue to send
+     */
+    bool sendNextCall(const QDeadlineTimer& previousCallEnded);
 private:
     class Private;
     Private* d;
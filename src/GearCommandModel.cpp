@@ -16,9 +16,9 @@
  */
 
 #include "GearCommandModel.h"
+#include "DeadlineScheduler.h"
 
 #include <QDebug>
-#include <QTimer>
 #include <QRandomGenerator>
 
 class GearCommandModel::Private
@@ -27,8 +27,70 @@ public:
     Private() {}
     ~Private() {}
 
+    // The definitions of the commands. These are left exactly as they were handed to us (so the
+    // list, and the strings in it, stay shared with wherever the commands were loaded from), and
+    // what is going on with each command on this device is kept in the states list instead,
+    // with one state for each row.
     CommandInfoList commands;
-    QHash<QString,QTimer*> commandDeactivators;
+    struct State {
+        bool isRunning{false};
+        bool isAvailable{true};
+    };
+    QList<State> states;
+    // The scheduled automatic deactivation of each command which is running
+    QHash<CommandAtoms::Atom, DeadlineScheduler::Handle> commandDeactivators;
+
+    // Commands are added at the start of the list, which moves every other command down
+    // by one row. Rather than renumbering all of the indexes below whenever that happens,
+    // they hold positions relative to rowOffset, which goes up by one every time a command
+    // is added, so the row of anything in the indexes is its position plus rowOffset.
+    int rowOffset{0};
+    // Where a command (or equivalence key) turns up more than once, the one nearest the
+    // start of the list wins, as that is the one a search through the list would find
+    QHash<CommandAtoms::Atom, int> byCommand;
+    QHash<CommandInfo::EquivalenceKey, int> byEquivalenceKey;
+    struct Group {
+        QList<int> members;
+        int runningCount{0};
+    };
+    QHash<int, Group> groups;
+
+    int rowOf(int position) const {
+        return position + rowOffset;
+    }
+
+    int findCommand(CommandAtoms::Atom command) const {
+        const auto it = byCommand.constFind(command);
+        return it == byCommand.constEnd() ? -1 : rowOf(it.value());
+    }
+
+    int findEquivalent(const CommandInfo& cmd) const {
+        const auto it = byEquivalenceKey.constFind(cmd.equivalenceKey());
+        return it == byEquivalenceKey.constEnd() ? -1 : rowOf(it.value());
+    }
+
+    void indexCommand(int row) {
+        const CommandInfo& command = commands.at(row);
+        const int position = row - rowOffset;
+        byCommand.insert(command.id(), position);
+        byEquivalenceKey.insert(command.equivalenceKey(), position);
+        Group& group = groups[command.group];
+        group.members << position;
+        if (states.at(row).isRunning) {
+            ++group.runningCount;
+        }
+    }
+
+    void rebuildIndexes() {
+        rowOffset = 0;
+        byCommand.clear();
+        byEquivalenceKey.clear();
+        groups.clear();
+        // Work from the back, so the commands nearest the start are indexed last, and win
+        for (int row = commands.count() - 1; row > -1; --row) {
+            indexCommand(row);
+        }
+    }
 };
 
 GearCommandModel::GearCommandModel(QObject* parent)
@@ -38,6 +100,9 @@ GearCommandModel::GearCommandModel(QObject* parent)
 
 GearCommandModel::~GearCommandModel()
 {
+    for (DeadlineScheduler::Handle handle : std::as_const(d->commandDeactivators)) {
+        DeadlineScheduler::getInstance()->cancel(handle);
+    }
     delete d;
 }
 
@@ -68,7 +133,7 @@ QVariant GearCommandModel::data(const QModelIndex& index, int role) const
                 value = command.command;
                 break;
             case IsRunning:
-                value = command.isRunning;
+                value = d->states.at(index.row()).isRunning;
                 break;
             case Category:
                 value = command.category;
@@ -83,7 +148,7 @@ QVariant GearCommandModel::data(const QModelIndex& index, int role) const
                 value = index.row();
                 break;
             case IsAvailable:
-                value = command.isAvailable;
+                value = d->states.at(index.row()).isAvailable;
                 break;
             default:
                 break;
@@ -104,6 +169,8 @@ void GearCommandModel::clear()
 {
     beginResetModel();
     d->commands.clear();
+    d->states.clear();
+    d->rebuildIndexes();
     endResetModel();
 }
 
@@ -111,87 +178,124 @@ void GearCommandModel::addCommand(const CommandInfo& command)
 {
     beginInsertRows(QModelIndex(), 0, 0);
     d->commands.insert(0, command);
+    d->states.insert(0, Private::State{command.isRunning, command.isAvailable});
+    ++d->rowOffset;
+    d->indexCommand(0);
     Q_EMIT commandAdded(command);
     endInsertRows();
 }
 
+void GearCommandModel::setCommands(const CommandInfoList& commands)
+{
+    beginResetModel();
+    d->commands.clear();
+    d->commands.reserve(commands.count());
+    d->states.clear();
+    d->states.reserve(commands.count());
+    // addCommand puts each new command at the start, so the last one ends up first
+    for (auto it = commands.crbegin(); it != commands.crend(); ++it) {
+        d->commands << *it;
+        d->states << Private::State{it->isRunning, it->isAvailable};
+    }
+    d->rebuildIndexes();
+    endResetModel();
+}
+
 void GearCommandModel::removeCommand(const CommandInfo& command)
 {
-    int idx{0};
-    bool found{false};
-    for (const CommandInfo& other : d->commands) {
-        if (command.compare(other)) {
-            found = true;
-            break;
+    int idx = d->findEquivalent(command);
+    if (idx > -1 && !command.compare(d->commands.at(idx))) {
+        // The equivalent command differs in its timing, so look for an exact match further down
+        idx = -1;
+        for (int i = 0; i < d->commands.count(); ++i) {
+            if (command.compare(d->commands.at(i))) {
+                idx = i;
+                break;
+            }
         }
-        ++idx;
     }
-    if (found) {
+    if (idx > -1) {
         beginRemoveRows(QModelIndex(), idx, idx);
         Q_EMIT commandRemoved(command);
         d->commands.removeAt(idx);
+        d->states.removeAt(idx);
+        // Removing moves everything after it up a row, so the positions need working out afresh
+        d->rebuildIndexes();
         endRemoveRows();
     }
 }
 
 void GearCommandModel::setRunning(const QString& command, bool isRunning)
 {
-//     qDebug() << "Command changing running state" << command << "being set to" << isRunning;
-    int i = -1;
-    for (CommandInfo& theCommand : d->commands) {
-        ++i;
-//         qDebug() << "Checking" << theCommand->command << "named" << theCommand->name;
-        if(theCommand.command == command) {
-//             qDebug() << "Found matching command!" << i;
-            if(theCommand.isRunning != isRunning) {
-//                 qDebug() << "Changing state";
-                QModelIndex idx = index(i, 0);
-                theCommand.isRunning = isRunning;
-                dataChanged(idx, idx, QVector<int>() << GearCommandModel::IsRunning << GearCommandModel::IsAvailable);
-
-                // ensure isAvailable is correct (check if any are running in our group, and set the availability accordingly)
-                bool hasAnyActive{false};
-                for (const CommandInfo& otherCommand : d->commands) {
-                    if (theCommand.group == otherCommand.group && otherCommand.isRunning) {
-                        hasAnyActive = true;
-                        break;
-                    }
-                }
-                int i2 = -1;
-                for (CommandInfo& otherCommand : d->commands) {
-                    ++i2;
-                    if (otherCommand.group == theCommand.group) {
-                        otherCommand.isAvailable = !hasAnyActive;
-                        QModelIndex idx2 = index(i2, 0);
-                        dataChanged(idx2, idx2, QVector<int>() << GearCommandModel::IsAvailable);
-                    }
+    // Anything not already in the atom table cannot be one of our commands
+    const CommandAtoms::Atom commandID = CommandAtoms::find(command);
+    if (commandID > 0) {
+        setRunning(commandID, isRunning);
+    }
+}
+
+void GearCommandModel::setRunning(CommandAtoms::Atom command, bool isRunning)
+{
+    setRunning(command, isRunning, false);
+}
+
+void GearCommandModel::setRunning(CommandAtoms::Atom command, bool isRunning, bool endedAutomatically)
+{
+//     qDebug() << "Command changing running state" << CommandAtoms::string(command) << "being set to" << isRunning;
+    const int i = d->findCommand(command);
+    if (i > -1) {
+        const CommandInfo& theCommand = d->commands.at(i);
+        // Anything listening to the signals below might end up changing the list, so
+        // hold onto what we need from the command before sending them out
+        const int deactivationInterval = theCommand.duration + theCommand.minimumCooldown;
+        if(d->states.at(i).isRunning != isRunning) {
+//             qDebug() << "Changing state";
+            d->states[i].isRunning = isRunning;
+            // ensure isAvailable is correct (the group is available while none of its commands are running)
+            Private::Group& group = d->groups[theCommand.group];
+            const bool wasAvailable = (group.runningCount == 0);
+            group.runningCount += isRunning ? 1 : -1;
+            const bool available = (group.runningCount == 0);
+            if (wasAvailable == available) {
+                dataChanged(index(i, 0), index(i, 0), QVector<int>() << GearCommandModel::IsRunning);
+            } else {
+                // Tell everybody about the whole group in one go, from the first to the last row in it
+                int first{i};
+                int last{i};
+                for (int position : std::as_const(group.members)) {
+                    const int row = d->rowOf(position);
+                    d->states[row].isAvailable = available;
+                    first = qMin(first, row);
+                    last = qMax(last, row);
                 }
+                dataChanged(index(first, 0), index(last, 0), QVector<int>() << GearCommandModel::IsRunning << GearCommandModel::IsAvailable);
             }
-            if (isRunning) {
-                // Hackery hacky time - if we end up running for longer than we're supposed to,
-                // assume that we missed something, and set ourselves available again.
-                // Also, we may end up in a situation where we have, in fact, been activated
-                // and deactivated correctly. In that case, let's not deactivate things we need
-                // to keep active. This could be done above, but keeping the code together feels
-                // simpler for future maintenance.
-                QTimer *timer = d->commandDeactivators[theCommand.command];
-                if (!timer) {
-                    timer = new QTimer(this);
-                    d->commandDeactivators[theCommand.command] = timer;
-                    timer->setSingleShot(true);
-                    timer->setInterval(theCommand.duration + theCommand.minimumCooldown);
-                    connect(timer, &QTimer::timeout, this, [this,&theCommand,timer]() {
-                        if (theCommand.isRunning) {
-                            qDebug() << "Automatically deactivating the following command - for some reason we seem to have missed the device ending the command." << theCommand.command;
-                            setRunning(theCommand.command, false);
-                        }
-                        d->commandDeactivators.remove(theCommand.command);
-                        timer->deleteLater();
-                    } );
+            Q_EMIT commandRunningChanged(command, isRunning, endedAutomatically);
+        }
+        if (isRunning) {
+            // Hackery hacky time - if we end up running for longer than we're supposed to,
+            // assume that we missed something, and set ourselves available again.
+            // Also, we may end up in a situation where we have, in fact, been activated
+            // and deactivated correctly. In that case, let's not deactivate things we need
+            // to keep active. This could be done above, but keeping the code together feels
+            // simpler for future maintenance.
+            // All of these go through the one scheduler (rather than a timer each), and the
+            // command is looked up again by its ID when the time comes, as the list may well
+            // have changed by then
+            const CommandAtoms::Atom commandID = command;
+            DeadlineScheduler* scheduler = DeadlineScheduler::getInstance();
+            scheduler->cancel(d->commandDeactivators.value(commandID));
+            d->commandDeactivators[commandID] = scheduler->scheduleIn(deactivationInterval, this, [this,commandID]() {
+                d->commandDeactivators.remove(commandID);
+                const int row = d->findCommand(commandID);
+                if (row > -1 && d->states.at(row).isRunning) {
+                    qDebug() << "Automatically deactivating the following command - for some reason we seem to have missed the device ending the command." << CommandAtoms::string(commandID);
+                    setRunning(commandID, false, true);
                 }
-                timer->start();
-            }
-            break;
+            });
+        } else {
+            // Ended properly, so there is nothing left to clean up after
+            DeadlineScheduler::getInstance()->cancel(d->commandDeactivators.take(command));
         }
     }
 //     qDebug() << "Done changing command running state";
@@ -204,29 +308,44 @@ const CommandInfoList& GearCommandModel::allCommands() const
 
 bool GearCommandModel::isRunning(const CommandInfo& cmd) const
 {
-    bool retVal{false};
-    for (const CommandInfo& ourCmd : d->commands) {
-        if (cmd.equivalent(ourCmd)) {
-            retVal = ourCmd.isRunning;
-            break;
-        }
-    }
-    return retVal;
+    const int row = d->findEquivalent(cmd);
+    return row > -1 && d->states.at(row).isRunning;
 }
 
 bool GearCommandModel::isAvailable(const CommandInfo& cmd) const
 {
-    static const QLatin1String tailHomeCommand{"TAILHM"};
     bool retVal{false};
-    if (cmd.command == tailHomeCommand) {
+    if (isAlwaysAvailable(cmd)) {
         retVal = true;
     } else {
-        for (const CommandInfo& ourCmd : d->commands) {
-            if (cmd.equivalent(ourCmd)) {
-                retVal = ourCmd.isAvailable;
-                break;
-            }
-        }
+        const int row = d->findEquivalent(cmd);
+        retVal = row > -1 && d->states.at(row).isAvailable;
     }
     return retVal;
 }
+
+bool GearCommandModel::isAlwaysAvailable(const CommandInfo& cmd)
+{
+    static const QLatin1String tailHomeCommand{"TAILHM"};
+    return cmd.command == tailHomeCommand;
+}
+
+bool GearCommandModel::isRunningAt(int row) const
+{
+    return row > -1 && row < d->states.count() && d->states.at(row).isRunning;
+}
+
+bool GearCommandModel::isAvailableAt(int row) const
+{
+    return row > -1 && row < d->states.count() && d->states.at(row).isAvailable;
+}
+
+int GearCommandModel::indexOf(CommandAtoms::Atom command) const
+{
+    return d->findCommand(command);
+}
+
+int GearCommandModel::indexOfEquivalent(const CommandInfo& cmd) const
+{
+    return d->findEquivalent(cmd);
+}
@@ -58,6 +58,14 @@ public:
      */
     void addCommand(const CommandInfo& command);
     Q_SIGNAL void commandAdded(const CommandInfo& command);
+    /**
+     * Replace all the commands in the model with the given list, in one go.
+     * The commands end up in the same order as they would if each of them had
+     * been added using addCommand, but the model is only reset once, and
+     * commandAdded is not emitted for the individual commands.
+     * @param commands The commands the model should hold
+     */
+    void setCommands(const CommandInfoList& commands);
     /**
      * Remove a command from the model.
      * The entry will be deleted by this function, and you should not attempt to
@@ -74,13 +82,53 @@ public:
      */
     void autofill(const QString& version);
     void setRunning(const QString& command, bool isRunning);
+    /**
+     * Set the running state of the command with the given atom
+     * @see CommandAtoms
+     */
+    void setRunning(CommandAtoms::Atom command, bool isRunning);
+    /**
+     * Emitted when the running state of a command changes, for example when
+     * the device reports that it has begun or ended the command
+     * @param command The atom of the command whose running state changed (see CommandAtoms)
+     * @param isRunning Whether or not the command is now running
+     * @param endedAutomatically True if the command was ended automatically, because the device
+     * never told us it had finished it. When that happens, the command's duration and cooldown
+     * have both already passed.
+     */
+    Q_SIGNAL void commandRunningChanged(CommandAtoms::Atom command, bool isRunning, bool endedAutomatically);
 
     /**
      * Get all the commands in this model
      *
-     * @return A list of all commands currently managed by this model
+     * @note The commands in this list are the definitions of the commands, exactly as
+     * they were added to the model, and their isRunning and isAvailable are not kept up
+     * to date. Use isRunningAt() and isAvailableAt() to find out about those.
+     *
+     * @return A list of all commands currently managed by this model, in row order
      */
     const CommandInfoList& allCommands() const;
+    /**
+     * @param row The row of the command in this model
+     * @return Whether the command on the given row is currently running on the device
+     */
+    bool isRunningAt(int row) const;
+    /**
+     * @param row The row of the command in this model
+     * @return Whether the command on the given row is currently available on the device
+     */
+    bool isAvailableAt(int row) const;
+    /**
+     * @param command The atom for a command (see CommandAtoms)
+     * @return The row of the command in this model, or -1 if there is no such command
+     */
+    int indexOf(CommandAtoms::Atom command) const;
+    /**
+     * @param cmd A command from somewhere else
+     * @return The row of the equivalent command in this model, or -1 if there is none
+     * @see CommandInfo::equivalent(const CommandInfo& other) const
+     */
+    int indexOfEquivalent(const CommandInfo& cmd) const;
 
     /**
      * Whether the equivalent command to cmd in this model is marked as running
@@ -107,7 +155,17 @@ public:
      * @see bool isRunning(const CommandInfo& cmd) const
      */
     bool isAvailable(const CommandInfo& cmd) const;
+
+    /**
+     * Whether the command is one which can always be sent to a device, even if it is not
+     * found in its model (such as TAILHM, the home position)
+     *
+     * @param cmd The command to check
+     * @return Whether the command is always available
+     */
+    static bool isAlwaysAvailable(const CommandInfo& cmd);
 private:
+    void setRunning(CommandAtoms::Atom command, bool isRunning, bool endedAutomatically);
     class Private;
     Private* d;
 };
@@ -18,6 +18,7 @@
 #include "GestureController.h"
 #include "BTConnectionManager.h"
 #include "CommandModel.h"
+#include "CommandQueue.h"
 #include "DeviceModel.h"
 #include "GearBase.h"
 #include "GestureDetectorModel.h"
@@ -62,16 +63,26 @@ public:
             // First get the command from the core model...
             CommandModel * commandModel = qobject_cast<CommandModel *>(connectionManager->commandModel());
             CommandInfo cmd = commandModel->getCommand(gesture->command());
+            QStringList targetDevices;
             for (int i = 0 ; i < deviceModel->count() ; ++i) {
                 GearBase* device = deviceModel->getDeviceById(i);
-                qDebug() << device->deviceID() << "of class type" << device->metaObject()->className() << "is connected?" << device->isConnected() << "is the command available?" << device->commandModel->isAvailable(cmd) << "with the command being" << cmd.command << "and is supposed to be a recipient of this command?" << (gesture->devices().count() == 0 || gesture->devices().contains(device->deviceID()));
-                // Now check if the device is connected, the device model says that command is available,
+                // The command being unavailable just means something else is running right now, and
+                // as the gesture cuts that short anyway, all we need is for the device to know the command
+                const bool knowsCommand = device->commandModel->indexOfEquivalent(cmd) > -1 || device->commandModel->isAvailable(cmd);
+                qDebug() << device->deviceID() << "of class type" << device->metaObject()->className() << "is connected?" << device->isConnected() << "does it know the command?" << knowsCommand << "with the command being" << cmd.command << "and is supposed to be a recipient of this command?" << (gesture->devices().count() == 0 || gesture->devices().contains(device->deviceID()));
+                // Now check if the device is connected, the device knows the command,
                 // and that it's supposed to be a recipient
-                if (device->isConnected() && device->commandModel->isAvailable(cmd)
+                if (device->isConnected() && knowsCommand
                     && (gesture->devices().count() == 0 || gesture->devices().contains(device->deviceID()))) {
-                    device->sendMessage(gesture->command());
+                    targetDevices << device->deviceID();
                 }
             }
+            // Gestures are a reaction to something happening right now, so they go ahead of
+            // (and cut short) whatever else might be going on on those devices
+            if (targetDevices.count() > 0) {
+                CommandQueue* queue = qobject_cast<CommandQueue*>(connectionManager->commandQueue());
+                queue->pushUrgentCommand(gesture->command(), targetDevices);
+            }
         }
     }
 };
@@ -67,11 +67,12 @@ public:
                                 targetDevices << device->deviceID();
                             }
                         }
+                        // Casual mode is the lowest priority, so anything else pushed to the queue goes ahead of it
                         if (targetDevices.length() > 0) {
-                            queue->pushCommand(command.command, targetDevices);
+                            queue->pushCommands(CommandInfoList{command}, targetDevices, CommandQueue::IdlePriority);
                         }
                     }
-                    queue->pushPause(QRandomGenerator::global()->bounded(appSettings->idleMinPause(), appSettings->idleMaxPause() + 1) * 1000, {});
+                    queue->pushCommands(CommandInfoList{CommandQueue::pauseCommand(QRandomGenerator::global()->bounded(appSettings->idleMinPause(), appSettings->idleMaxPause() + 1) * 1000)}, {}, CommandQueue::IdlePriority);
                 }
             }
         }
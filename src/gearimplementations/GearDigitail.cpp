@@ -164,13 +164,8 @@ public:
                     q->commandModel->setRunning(theCommand, (stateResult[0] == aBegin));
                     // Now let's just see whether that second thing is actually a full command or not (at which point
                     // we should be expecting another notification shortly)
-                    bool fullCommand{false};
-                    for(const CommandInfo& cmd : std::as_const(q->commandModel->allCommands())) {
-                        if (cmd.command == stateResult[2]) {
-                            fullCommand = true;
-                            break;
-                        }
-                    }
+                    const CommandAtoms::Atom secondCommand = CommandAtoms::find(stateResult[2]);
+                    const bool fullCommand = (secondCommand > 0 && q->commandModel->indexOf(secondCommand) > -1);
                     if (fullCommand) {
                         q->commandModel->setRunning(stateResult[2], (startOrEnd == aBegin));
                         qDebug() << "Detected a complete squashed command, with the command" << theCommand << ", the type" << stateResult[0] << ", the startOrEnd" << startOrEnd << ", and the end command" << stateResult[2];
@@ -120,12 +120,10 @@ void GearFake::sendMessage(const QString& message)
 {
     qDebug() << "Fakery for" << message;
     CommandInfo commandInfo;
-    const CommandInfoList& commands = commandModel->allCommands();
-    for (const CommandInfo& command : commands) {
-        if (command.command == message) {
-            commandInfo = command;
-            break;
-        }
+    const CommandAtoms::Atom messageID = CommandAtoms::find(message);
+    const int row = (messageID > 0) ? commandModel->indexOf(messageID) : -1;
+    if (row > -1) {
+        commandInfo = commandModel->allCommands().at(row);
     }
     if(commandInfo.isValid()) {
         commandModel->setRunning(message, true);
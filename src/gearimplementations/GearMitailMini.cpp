@@ -30,6 +30,7 @@
 #include <QTimer>
 
 #include "AppSettings.h"
+#include "DeadlineScheduler.h"
 
 class GearMitailMini::Private {
 public:
@@ -48,7 +49,6 @@ public:
 
     QString currentCall;
     QString currentSubCall;
-    QStringList callQueue;
 
     QLowEnergyController* btControl{nullptr};
     QLowEnergyService* deviceService{nullptr};
@@ -146,6 +146,8 @@ public:
 
     void characteristicChanged(const QLowEnergyCharacteristic &characteristic, const QByteArray &newValue)
     {
+        // Note when this arrived before doing anything else, as pauses between calls count from then
+        const QDeadlineTimer receivedAt = DeadlineScheduler::deadlineIn(0);
         qDebug() << q->name() << q->deviceID() << "Current call is supposed to be" << currentCall << "and characteristic" << characteristic.uuid() << "NOTIFIED value change" << newValue;
 
         if (deviceCommandReadCharacteristicUuid == characteristic.uuid()) {
@@ -212,26 +214,7 @@ public:
             }
             else if (stateResult.last() == QLatin1String{"END"}) {
                 // If we've got more in the queue, send the next bit of the command
-                if (callQueue.length() > 0) {
-                    int pauseDuration{0};
-                    QString message = callQueue.takeFirst();
-                    while (message.startsWith(QLatin1String{"PAUSE"})) {
-                        QStringList pauseCommand = message.split(QLatin1Char{' '});
-                        int pause = pauseCommand.value(1).toInt();
-                        pauseDuration += pause;
-                        message = callQueue.takeFirst();
-                        qDebug() << q->name() << q->deviceID() << "Found a pause, so we're now waiting" << pauseDuration << "milliseconds";
-                    }
-                    if (pauseDuration > 0) {
-                        // Just in case some funny person stuck a pause at the end...
-                        if (message.length() > 0) {
-                            // Clamp the max single pause duration to 3000 ms (the conceptual human moment)
-                            QTimer::singleShot(qMax(3000, pauseDuration), q, [this, message](){ q->sendMessage(message); });
-                        }
-                    }
-                    else {
-                        q->sendMessage(message);
-                    }
+                if (q->sendNextCall(receivedAt)) {
                     // ****************************************************
                     // ******************* EARLY RETURN *******************
                     // ****************************************************
@@ -633,31 +616,28 @@ QString GearMitailMini::currentCall() const
     return d->currentCall;
 }
 
-static const QLatin1Char semicolon{';'};
 void GearMitailMini::sendMessage(const QString &message)
 {
-    if (d->firmwareProgress == -1) {
-        QString actualMessage{message};
-        if (commandShorthands.contains(message)) {
-            actualMessage = commandShorthands[message];
-        }
+    sendProgram(compileMessage(message));
+}
 
+void GearMitailMini::writeProgram(const Program &program)
+{
+    if (d->firmwareProgress == -1) {
         if (d->deviceCommandWriteCharacteristic.isValid() && d->deviceService) {
-            QString actualCall{actualMessage};
-            if (actualMessage.contains(semicolon)) {
-                d->callQueue = actualMessage.split(semicolon);
-                actualCall = d->callQueue.takeFirst();
+            if (program.hasCallQueue) {
+                callQueue = program.callQueue;
             }
-            if (actualMessage != message) {
+            if (program.isExpanded) {
                 // As we're translating, we need to manually set this message as running and not trust the device to tell us
-                commandModel->setRunning(message, true);
+                commandModel->setRunning(program.messageID, true);
             }
 
-            d->currentSubCall = actualCall;
-            d->deviceService->writeCharacteristic(d->deviceCommandWriteCharacteristic, actualCall.toUtf8());
-            d->currentCall = message;
-            Q_EMIT currentCallChanged(message);
-            if (message == SHUTDOWN_MESSAGE) {
+            d->currentSubCall = program.firstCall;
+            d->deviceService->writeCharacteristic(d->deviceCommandWriteCharacteristic, program.encodedFirstCall);
+            d->currentCall = program.message;
+            Q_EMIT currentCallChanged(program.message);
+            if (program.message == SHUTDOWN_MESSAGE) {
                 deleteLater();
             }
         }
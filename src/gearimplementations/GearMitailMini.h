@@ -47,6 +47,8 @@ public:
     Q_INVOKABLE void setOTAData ( const QString& md5sum, const QByteArray& firmware ) override;
     bool hasOTAData() override;
     Q_INVOKABLE void startOTA() override;
+protected:
+    void writeProgram(const Program &program) override;
 private:
     class Private;
     Private* d;
@@ -0,0 +1,58 @@
+/*
+ *   Copyright 2019 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+import QtQuick
+
+import org.thetailcompany.digitail as Digitail
+
+/**
+ * Counts down the time left of the command most recently launched by the queue.
+ * The queue only tells us when that command started and when it is planned to
+ * end, so rather than asking the service how long is left, we work it out here,
+ * and only tick while there is actually something counting down.
+ */
+QtObject {
+    id: component
+    /**
+     * How often the remaining time is updated, in milliseconds
+     */
+    property int interval: 100
+    /**
+     * The number of milliseconds left of the current command (including its cooldown),
+     * or zero if no command is running
+     */
+    readonly property int remainingMSeconds: Math.max(0, Digitail.CommandQueue.currentCommandDeadline - now)
+    /**
+     * How far along the current command is, from 0 to 1 (or 1 if no command is running)
+     */
+    readonly property real progress: {
+        let total = Digitail.CommandQueue.currentCommandDeadline - Digitail.CommandQueue.currentCommandStarted;
+        return total > 0 ? Math.min(1, Math.max(0, (now - Digitail.CommandQueue.currentCommandStarted) / total)) : 1;
+    }
+
+    property double now: Date.now()
+    property Timer ticker: Timer {
+        interval: component.interval
+        repeat: true
+        running: component.remainingMSeconds > 0
+        onTriggered: component.now = Date.now()
+    }
+    property Connections deadlineWatcher: Connections {
+        target: Digitail.CommandQueue
+        function onCurrentCommandDeadlineChanged() { component.now = Date.now(); }
+    }
+}
@@ -32,7 +32,7 @@ Kirigami.ScrollablePage {
             icon.name: "go-home";
             displayHint: Kirigami.DisplayHint.KeepVisible;
             onTriggered: {
-                Digitail.BTConnectionManager.sendMessage("TAILHM", []);
+                Digitail.CommandQueue.pushUrgentCommand("TAILHM", []);
             }
         }
     ]
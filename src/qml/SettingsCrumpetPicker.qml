@@ -28,7 +28,7 @@ Kirigami.ScrollablePage {
 
     ListView {
         id: crumpetList;
-        model: Object.keys(Digitail.AppSettings.commandFiles);
+        model: Digitail.AppSettings.commandFiles;
         Digitail.FilterProxyModel {
             id: deviceFilterProxy;
             sourceModel: Digitail.DeviceModel;
@@ -52,8 +52,7 @@ Kirigami.ScrollablePage {
         }
         delegate: Kirigami.SwipeListItem {
             id: listItem;
-            property var commandFile: Digitail.AppSettings.commandFiles[modelData];
-            property bool isEnabled: deviceFilterProxy.enabledFiles ? deviceFilterProxy.enabledFiles.includes(modelData) : false;
+            property bool isEnabled: deviceFilterProxy.enabledFiles ? deviceFilterProxy.enabledFiles.includes(model.filename) : false;
             Layout.fillWidth: true;
             RowLayout {
                 Layout.fillWidth: true;
@@ -72,15 +71,15 @@ Kirigami.ScrollablePage {
                 QQC2.Label {
                     Layout.fillWidth: true;
                     wrapMode: Text.Wrap;
-                    text: commandFile.title
+                    text: model.title
                 }
             }
             onClicked: {
-                Digitail.BTConnectionManager.setDeviceCommandsFileEnabled(component.deviceID, modelData, !listItem.isEnabled);
+                Digitail.BTConnectionManager.setDeviceCommandsFileEnabled(component.deviceID, model.filename, !listItem.isEnabled);
             }
             actions: [
                 Kirigami.Action {
-                    visible: commandFile.isEditable;
+                    visible: model.isEditable;
                     text: i18nc("Button for deleting a Command Set, on the page for configuring Command Sets", "Delete");
                     icon.name: "list-remove";
                     displayHint: Kirigami.DisplayHint.KeepVisible;
@@ -88,7 +87,7 @@ Kirigami.ScrollablePage {
                         showMessageBox(i18nc("Header for the confirmation prompt for removing a command set, on the Gear Command Sets page", "Remove Command Set?"),
                             i18nc("Message for the confirmation prompt for removing a command set, on the Gear Command Sets page", "Are you sure that you want to remove this command set? Note this cannot be undone."),
                             function () {
-                                Digitail.AppSettings.removeCommandFile(modelData);
+                                Digitail.AppSettings.removeCommandFile(model.filename);
                             });
                     }
                 },
@@ -98,15 +97,15 @@ Kirigami.ScrollablePage {
                     displayHint: Kirigami.DisplayHint.KeepVisible;
                     onTriggered: {
                         var newFileName = "internal-crumpet-" + crumpetList.count;
-                        Digitail.AppSettings.addCommandFile(newFileName, commandFile.contents);
+                        Digitail.AppSettings.duplicateCommandFile(model.filename, newFileName);
                     }
                 },
                 Kirigami.Action {
-                    visible: commandFile.isEditable;
+                    visible: model.isEditable;
                     text: i18nc("Button for editing a Command Set, on the page for configuring Command Sets", "Edit Commands");
                     icon.name: "document-edit";
                     displayHint: Kirigami.DisplayHint.KeepVisible;
-                    onTriggered: { pageStack.push( crumpetEditor, { filename: modelData } ); }
+                    onTriggered: { pageStack.push( crumpetEditor, { filename: model.filename } ); }
                 }
             ]
         }
@@ -118,8 +117,17 @@ Kirigami.ScrollablePage {
                 objectName: "crumpetEditor";
                 title: i18nc("Header for the overlay for editing a Command Set, on the page for configuring Command Sets", "Edit Commands")
 
+                // The contents are not kept around in the app, so ask for them when we need them
                 Component.onCompleted: {
-                    contentEditor.text = Digitail.AppSettings.commandFiles[editorPage.filename].contents;
+                    Digitail.AppSettings.requestCommandFileContents(editorPage.filename);
+                }
+                Connections {
+                    target: Digitail.AppSettings
+                    function onCommandFileContents(filename, content) {
+                        if (filename === editorPage.filename) {
+                            contentEditor.text = content;
+                        }
+                    }
                 }
 
                 actions: [
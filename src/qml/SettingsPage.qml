@@ -91,6 +91,18 @@ Kirigami.ScrollablePage {
             }
         }
 
+        SettingsCard {
+            headerText: i18nc("Header for the panel for whether or not queued commands should follow the timing reported by the gear, on the settings page", "Follow Gear Timing");
+            descriptionText: i18nc("Description for the panel for whether or not queued commands should follow the timing reported by the gear, on the settings page", "When sending a list of moves, the app normally waits for the time each move is expected to take before sending the next one. Check the box here to instead send the next move as soon as your gear tells the app that it has finished the previous one, which avoids pauses between moves that finish early, and waiting for moves that take longer than expected.");
+            footer: QQC2.CheckBox {
+                text: i18nc("Checkbox for the option to have queued commands follow the timing reported by the gear, on the panel for following gear timing in the settings page", "Follow Gear Timing");
+                checked: Digitail.AppSettings.queueFollowsGear;
+                onClicked: {
+                    Digitail.AppSettings.queueFollowsGear = !Digitail.AppSettings.queueFollowsGear;
+                }
+            }
+        }
+
         SettingsCard {
             headerText: i18nc("Header for the panel showing known gear, on the settings page", "Known Gear");
             descriptionText: i18nc("Description for the panel showing known gear, on the settings page", "Below is a list of the gear you have previously connected to. You can use this list to perform a number of actions, such as explicitly toggling whether or not to automatically connect to it when it's found, to change its name, and even forgetting it. Forgetting it will disconnect (using the Just Disconnect method) from it, if you are currently connected.");
@@ -112,7 +112,7 @@ ColumnLayout {
                     Layout.fillWidth: true
                     Layout.fillHeight: true
                     verticalAlignment: Text.AlignVCenter
-                    text: typeof model.activeCommandTitles !== "undefined" ? model.activeCommandTitles : ""
+                    text: typeof model.activeCommandTitles !== "undefined" ? model.activeCommandTitles.join(", ") : ""
                     opacity: text === "" ? 0 : 0.5
                     elide: Text.ElideRight;
                     Behavior on opacity { NumberAnimation { duration: Kirigami.Units.longDuration; } }
@@ -17,6 +17,7 @@
  */
 
 import QtQuick
+import QtQuick.Controls as QQC2
 import org.kde.kirigami as Kirigami
 import org.thetailcompany.digitail as Digitail
 
@@ -29,10 +30,18 @@ Kirigami.ScrollablePage {
             icon.name: "dialog-cancel";
             displayHint: Kirigami.DisplayHint.KeepVisible;
             onTriggered: {
-                Digitail.BTConnectionManager.sendMessage("TAILHM", []);
+                Digitail.CommandQueue.pushUrgentCommand("TAILHM", []);
             }
         }
     ]
+    // Shows how far along the move most recently sent off by the queue is
+    property CommandCountdown commandCountdown: CommandCountdown { }
+    footer: QQC2.ProgressBar {
+        visible: commandCountdown.remainingMSeconds > 0;
+        from: 0;
+        to: 1;
+        value: commandCountdown.progress;
+    }
     BaseMovesComponent {
         infoText: i18nc("Description for the list of moves, on the Moves page", "The list below shows all the moves available to your gear. Tap any of them to send them off to any of your connected devices! If you have more than one connected, the little coloured dots show which you can send that move to.");
         onCommandActivated: function(command, destinations) {